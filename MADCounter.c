@@ -1,18 +1,78 @@
+// POSIX process and thread functions (fork, pipe, waitpid for --compress,
+// pthreads for -o fan-out, clock_gettime for --stats); -std=c99 hides them
+// otherwise. macOS also hides ru_maxrss without _DARWIN_C_SOURCE, and glibc
+// hides syscall() (for --perf-counters) without _DEFAULT_SOURCE.
+#define _POSIX_C_SOURCE 200809L
+#define _DARWIN_C_SOURCE
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 // =============================================================================
 // CONSTANTS AND DEFINITIONS
 // =============================================================================
 
 // Maximum buffer sizes for reading from files
-#define MAX_WORD_LENGTH 1000      // Max length of a single word
-#define MAX_LINE_LENGTH 10000     // Max length of a single line
 #define MAX_BATCH_LINE_LENGTH 10000  // Max length of a batch file line
 #define ASCII_RANGE 128           // ASCII characters are 0-127 (128 total)
 #define MAX_TOKENS 100            // Max number of command tokens in batch line
-#define MAX_FLAGS 5               // Max number of analysis flags (-c, -w, -l, -Lw, -Ll)
+#define MAX_MATCH_PATTERNS 16     // Max number of --match substrings per command
+#define MAX_OUTPUT_TARGETS 8      // Max number of -o fmt:path outputs per command
+#define MAX_DFA_STATES 2048       // --regex DFA cache size; the cache is flushed when full
+#define DFA_LOOKUP_SIZE 4096      // Slots in the hash index of cached DFA states (2 x states)
+#define MAX_REGEX_DEPTH 256       // Max nesting of ( ) in a --regex pattern
+#define STOPWORD_PREFILTER_BITS (32 * BYTE_RANGE)  // One bit per (length mod 32, first byte)
+#define MAX_FLAGS 9               // Max number of analysis flags (-c, -w, -l, -Lw, -Ll, -c2, -hw, -hl, -cu)
+#define BYTE_RANGE 256            // A byte pair is drawn from 256 x 256 possible values
+#define PAIR_RANGE (BYTE_RANGE * BYTE_RANGE)
+#define PAIR_LANES 4              // Interleaved sub-tables used while counting byte pairs
+#define CHAR_BLOCK_SIZE (1 << 15) // -c/-c2 count a block at a time, so -c2 reads it from cache
+#define HISTOGRAM_EXACT_LENGTHS 256  // Lengths 0-255 get one histogram bin each
+#define HISTOGRAM_LOG_BUCKETS 64     // Longer lengths share power-of-two bins [2^k, 2^(k+1))
+#define CODE_POINT_TABLE_START 256   // Initial slots in the non-ASCII code point table
+#define WORD_TABLE_START 1024        // Initial slots in a word/line hash table
+#define BUCKET_TABLE_START 64        // Initial slots in the --time-buckets bucket index
+#define POSTING_BLOCK_START 16       // Bytes in a word's first --positions block
+#define POSTING_BLOCK_MAX 4096       // Blocks double in size up to this many bytes
+#define MAX_VARINT_BYTES 5           // Longest LEB128 encoding of a 32-bit value
+#define POSTING_BATCH 262144         // Occurrences queued before they are added to posting lists
+#define POSITION_INDEX_MAGIC "MADPOS01"
+#define POSITION_INDEX_VERSION 1
+#define POSITION_HEADER_SIZE 48      // Bytes in the index file header
+#define POSITION_ENTRY_SIZE 32       // Bytes per word in the index directory
+#define WRITER_BUFFER_SIZE (1 << 16) // Bytes buffered by --format output before each fwrite
+#define RESULT_FILE_MAGIC "MADRES01"
+#define RESULT_FILE_VERSION 1
+#define RESULT_HEADER_SIZE 16        // Bytes in a --format bin file header
+#define RESULT_SECTION_SIZE 32       // Bytes in each section header
+#define RESULT_TRAILER_SIZE 8        // Section count and CRC-32 at the end of the file
+#define ARROW_BATCH_ROWS (1 << 20)   // Most rows per --format arrow record batch
+#define ARROW_ALIGNMENT 8            // Arrow IPC buffers and messages start on 8-byte boundaries
+#define ARROW_METADATA_V5 4          // MetadataVersion.V5
+#define ARROW_COLUMNS 5              // section, item, count, position, length
+#define ARROW_BUFFERS 11             // Body buffers of one record batch (see writeArrowBatch)
+#define FB_MAX_FIELDS 8              // Most fields in one hand-built flatbuffer table
+
+// Character classes used by the word tokenizer (bits in a BYTE_RANGE table)
+#define CLASS_SEPARATOR 1   // Ends a word (whitespace, plus any --delims characters)
+#define CLASS_PUNCT     2   // Trimmed from both ends of a word with --strip-punct
 
 // Flag order constants - used to track the order flags appear on the command line
 #define FLAG_C  0   // Character analysis (-c)
@@ -20,22 +80,461 @@
 #define FLAG_L  2   // Line analysis (-l)
 #define FLAG_LW 3   // Longest word (-Lw)
 #define FLAG_LL 4   // Longest line (-Ll)
+#define FLAG_C2 5   // Byte-pair (bigram) analysis (-c2)
+#define FLAG_HW 6   // Word length histogram (-hw)
+#define FLAG_HL 7   // Line length histogram (-hl)
+#define FLAG_CU 8   // UTF-8 code point analysis (-cu)
+
+// Timestamp formats for --time-buckets
+#define TS_ISO    1   // 2024-05-01T10:05:00 (or a space instead of the T)
+#define TS_SYSLOG 2   // May  1 10:05:00
+#define TS_EPOCH  3   // 1714557900 (seconds since 1970)
+
+// --sort orders for the -w/-l listings
+#define SORT_ALPHA 0   // ASCII order (the default)
+#define SORT_FREQ  1   // By frequency
+#define SORT_FIRST 2   // By first position
+#define SORT_LEN   3   // By length
+#define SORT_NONE  4   // --order first-seen: list left in insertion order
+
+// --format output formats
+#define FORMAT_TEXT  0   // The human-readable report (the default)
+#define FORMAT_JSON  1   // One JSON document
+#define FORMAT_JSONL 2   // JSON Lines: one object per line
+#define FORMAT_CSV   3   // Comma-separated rows (RFC 4180 quoting)
+#define FORMAT_TSV   4   // Tab-separated rows (backslash escapes)
+#define FORMAT_BIN   5   // Columnar binary file, read back with --dump
+#define FORMAT_ARROW 6   // Apache Arrow IPC stream
+
+// --stats phases, in the order analyzeFile runs them
+#define PHASE_READ   0   // Opening the files and reading the input
+#define PHASE_CHARS  1   // -c, -c2 and -cu counting
+#define PHASE_SCAN   2   // Tokenizing and counting words and lines (one pass)
+#define PHASE_SORT   3   // Sorting the word and line lists
+#define PHASE_RENDER 4   // Writing the reports (and --positions)
+#define PHASE_COUNT  5
+
+// --alloc-stats memory categories
+#define MEM_NODES   0   // Word and line nodes (and their --positions posting lists)
+#define MEM_STRINGS 1   // Word and line text
+#define MEM_TABLES  2   // Hash slots, count tables and the --regex matcher
+#define MEM_BUFFERS 3   // The file data and the scan and output buffers
+#define MEM_SORT    4   // Sort keys, scratch space and arrays of pointers to sort
+#define MEM_CATEGORY_COUNT 5
+
+// --perf-counters hardware events, in the order they are reported
+#define PERF_CYCLES        0   // The group leader
+#define PERF_INSTRUCTIONS  1
+#define PERF_CACHE_MISSES  2
+#define PERF_BRANCH_MISSES 3
+#define PERF_DTLB_MISSES   4
+#define PERF_EVENT_COUNT   5
+
+// --compress compressors for the -o file
+#define COMPRESS_NONE 0
+#define COMPRESS_GZIP 1
+#define COMPRESS_ZSTD 2
+
+// --diff-rank orders for the --diff listing
+#define DIFF_RANK_ALPHA 0   // Alphabetical (the default)
+#define DIFF_RANK_ABS   1   // Biggest absolute change first
+#define DIFF_RANK_REL   2   // Biggest change relative to the first file first
 
 // =============================================================================
 // DATA STRUCTURES
 // =============================================================================
 
+// POSTING_BLOCK struct - one chunk of a word's --positions posting list
+// Positions are stored as LEB128 varints of the gap from the previous
+// position, so a frequent word costs about one byte per occurrence
+typedef struct postingBlock {
+    struct postingBlock *next;
+    int capacity;             // Bytes available in data
+    int used;                 // Bytes filled so far
+    unsigned char data[];     // Varint-encoded position gaps
+} POSTING_BLOCK;
+
+// POSTING_LIST struct - every position a word occurs at (--positions)
+typedef struct postingList {
+    POSTING_BLOCK *first;
+    POSTING_BLOCK *last;      // Where new positions are appended
+    int lastPosition;         // Previous position, to encode the next gap
+    int count;                // Number of positions recorded
+    long totalBytes;          // Encoded size of the whole list
+} POSTING_LIST;
+
 // WORD struct - used for both word and line analysis
 // This is a node in a linked list that stores information about a word or line
 typedef struct word {
     char *contents;           // Pointer to the actual string (dynamically allocated)
     int numChars;             // Length of the string
     int frequency;            // How many times this word/line appears in the file
+    int frequencyB;           // --diff: how many times it appears in the second file
     int orderAppeared;        // Position where it first appeared (0-indexed)
+    uint32_t hashValue;       // Hash of the (case-folded, with -i) contents
+    POSTING_LIST *postings;   // --positions: every occurrence (NULL = not recorded)
     struct word *nextWord;    // Pointer to the next node in the linked list
     struct word *prevWord;    // Pointer to the previous node in the linked list
 } WORD;
 
+// WORD_TABLE struct - hash index over the nodes of one word or line list
+// While counting, nodes are appended to the list in first-seen order and
+// found again through the hash slots; finishWordTable() then sorts the list
+// alphabetically once, instead of keeping it sorted on every insert
+typedef struct wordTable {
+    WORD **slots;             // Open-addressing slots (NULL = empty)
+    int tableSize;            // Number of slots (always a power of two)
+    int uniqueCount;          // Number of nodes in the list
+    WORD *head;               // First node (first-seen order while counting)
+    WORD *tail;               // Last node, where new entries are appended
+    int foldCase;             // -i: "The" and "the" are the same entry
+    int printLowercase;       // --case-print lower: store/print the folded form
+    int countSecond;          // --diff: count into frequencyB instead of frequency
+    int recordPositions;      // --positions: keep every occurrence's position
+    int sortOrder;            // --sort: how finishWordTable() orders the list (SORT_*)
+    int sortDescending;       // --sort ...-desc: reverse that order
+    WORD **pendingNodes;      // --positions: occurrences not yet in a posting list
+    int *pendingPositions;
+    int pendingCount;
+} WORD_TABLE;
+
+// SORT_KEY struct - a node and its precomputed --sort key
+typedef struct sortKey {
+    uint64_t key;
+    WORD *node;
+} SORT_KEY;
+
+// LENGTH_HISTOGRAM struct - how many words (or lines) there are of each length
+// Short lengths are counted exactly; anything of HISTOGRAM_EXACT_LENGTHS or
+// more lands in a power-of-two bucket so a multi-megabyte line costs one bin
+typedef struct lengthHistogram {
+    int exact[HISTOGRAM_EXACT_LENGTHS];      // exact[n] = count of length n
+    int logBuckets[HISTOGRAM_LOG_BUCKETS];   // logBuckets[k] = count of length in [2^k, 2^(k+1))
+    int total;                               // Number of words/lines counted
+    long maxLength;                          // Longest length seen
+} LENGTH_HISTOGRAM;
+
+// Kinds of NFA state in a compiled --regex
+#define RX_SET   0   // Consumes one byte in its byte set, then goes to out
+#define RX_SPLIT 1   // Epsilon move to both out and out1
+#define RX_EMPTY 2   // Epsilon move to out
+#define RX_BOL   3   // Epsilon move to out, only at the start of the line (^)
+#define RX_EOL   4   // Epsilon move to out, only at the end of the line ($)
+#define RX_MATCH 5   // The whole pattern has matched
+
+// REGEX_STATE struct - one NFA state (Thompson construction)
+typedef struct regexState {
+    int type;                     // RX_* constant
+    unsigned char byteSet[32];    // RX_SET: bit b set = byte b accepted
+    int out;                      // Next state (-1 = not patched yet)
+    int out1;                     // RX_SPLIT: second next state
+} REGEX_STATE;
+
+// DFA_STATE struct - one cached DFA state: a set of NFA states
+typedef struct dfaState {
+    int *nfaStates;               // Sorted NFA state numbers (RX_SET, RX_EOL, RX_MATCH only)
+    int nfaCount;
+    uint32_t hashValue;
+    int accepting;                // Contains RX_MATCH: the line matches already
+    int acceptsAtEnd;             // Would match if the line ended here (passes $)
+} DFA_STATE;
+
+// REGEX struct - a --regex pattern compiled to an NFA, run as a lazily built DFA
+// DFA states are created the first time a transition needs them and kept in
+// a bounded cache; when the cache fills up it is flushed and rebuilt on
+// demand, so memory stays fixed no matter how the pattern behaves.
+typedef struct regex {
+    REGEX_STATE *states;          // NFA states
+    int stateCount;
+    int stateCapacity;
+    int startState;               // NFA start
+    unsigned char byteClass[BYTE_RANGE];  // Bytes no pattern tells apart share a class
+    int classCount;
+    DFA_STATE dfa[MAX_DFA_STATES];
+    int dfaCount;
+    int *transitions;             // dfaCount x classCount, -1 = not built yet
+    int lookup[DFA_LOOKUP_SIZE];  // Hash index into dfa (-1 = empty)
+    int dfaStart;                 // DFA state at the start of a line
+    int *work;                    // Scratch space for building NFA state sets
+    int *workMark;                // Per NFA state: last generation it was added in
+    int generation;
+} REGEX;
+
+// LINE_FILTER struct - which lines scanText should look at (--match, --regex)
+// A line passes if it contains all of the patterns and matches the regex
+// (or, with matchAny, passes at least one of them). Lines that fail are
+// skipped before tokenizing.
+typedef struct lineFilter {
+    const char *patterns[MAX_MATCH_PATTERNS];
+    int patternLengths[MAX_MATCH_PATTERNS];
+    int patternCount;
+    REGEX *regex;             // --regex (NULL = none)
+    int matchAny;             // --match-any: OR the patterns instead of AND
+} LINE_FILTER;
+
+// STOPWORD struct - one slot of a stopword set
+typedef struct stopword {
+    const char *text;         // Points into the set's copy of the stopword file (NULL = empty slot)
+    int length;
+    uint32_t hashValue;       // hashToken() of the word
+} STOPWORD;
+
+// STOPWORD_SET struct - words to leave out of word analysis (--stopwords)
+// Most words are not stopwords, so a small bitset keyed on (length, first
+// byte) answers "definitely not" for most of them before any hashing; only
+// words that get past it are hashed and looked up.
+typedef struct stopwordSet {
+    unsigned char prefilter[STOPWORD_PREFILTER_BITS / 8];
+    STOPWORD *slots;          // Open-addressing hash table
+    int tableSize;            // Number of slots (always a power of two)
+    int count;                // Number of distinct stopwords
+    int foldCase;             // -i: compare ignoring ASCII case
+    char *text;               // The stopword file contents
+    long textSize;            // Its size as allocated (less the '\0' byte)
+} STOPWORD_SET;
+
+// MEM_CATEGORY struct - --alloc-stats totals for one MEM_* category
+typedef struct memCategory {
+    long long allocations;    // Blocks allocated (a realloc counts as one)
+    long long allocated;      // Bytes allocated, in all
+    long long live;           // Bytes allocated and not freed yet
+    long long peak;           // Most bytes live at once
+} MEM_CATEGORY;
+
+// RUN_STATS struct - what --stats measured
+// Only the phase boundaries read the clocks, so measuring costs nothing
+// inside the loops
+typedef struct runStats {
+    double wall[PHASE_COUNT];       // Seconds spent in each phase (PHASE_*)
+    double cpu[PHASE_COUNT];        // CPU seconds in each phase, all threads
+    struct timespec lastWall;       // Clock readings at the last boundary
+    struct timespec lastCpu;
+    long long bytes;                // Bytes of input read
+    int wordEntries;                // Word table when counting ended: entries...
+    int wordSlots;                  //   ...and hash slots (0 = no table)
+    int lineEntries;                // Line table, the same
+    int lineSlots;
+    int perfCounters;               // --perf-counters: also read the hardware counters
+    uint64_t perfLast[PERF_EVENT_COUNT];           // Counter readings at the last boundary
+    uint64_t perf[PHASE_COUNT][PERF_EVENT_COUNT];  // Counts charged to each phase
+} RUN_STATS;
+
+// TEXT_SCAN struct - what one scanText pass should collect, and what it found
+// Words and lines come out of the same pass over the in-memory file
+typedef struct textScan {
+    int buildWordList;                 // Insert every word into the word list (-w, -Lw)
+    int buildLineList;                 // Insert every line into the line list (-l, -Ll)
+    int foldCase;                      // -i: case-insensitive words and lines
+    int printLowercase;                // --case-print lower (otherwise first-seen form)
+    const unsigned char *charClass;    // BYTE_RANGE table of CLASS_* bits (see buildCharClassTable)
+    int stripPunct;                    // --strip-punct: trim CLASS_PUNCT bytes off each word
+    LINE_FILTER *lineFilter;           // Only scan lines that pass (NULL = every line)
+    STOPWORD_SET *stopwords;           // Words never inserted into the word list (NULL = none)
+    WORD_TABLE *wordTable;             // Count into this table and leave it unsorted (NULL =
+    WORD_TABLE *lineTable;             //   scanText's own, sorted into wordHead/lineHead)
+    int recordPositions;               // --positions: keep every word's positions
+    int column;                        // --column: count this field (1-based) instead of words
+    char separator;                    // --sep: the field separator for --column
+    int sortOrder;                     // --sort: order of the -w/-l listings (SORT_*)
+    int sortDescending;                // --sort ...-desc
+    int countStopwords;                // --count-stopwords: stopwords still count in totals
+    LENGTH_HISTOGRAM *wordLengths;     // Word length histogram (NULL = not wanted)
+    LENGTH_HISTOGRAM *lineLengths;     // Line length histogram (NULL = not wanted)
+    RUN_STATS *stats;                  // --stats: time the scan and sort (NULL = not wanted)
+    WORD *wordHead;                    // Sorted list of unique words
+    int totalWords;
+    int uniqueWords;
+    WORD *lineHead;                    // Sorted list of unique lines
+    int totalLines;
+    int uniqueLines;
+} TEXT_SCAN;
+
+// SORTED_LINES struct - what --presorted learned from checking the lines
+typedef struct sortedLines {
+    int totalLines;
+    int uniqueLines;
+    long longestLength;
+} SORTED_LINES;
+
+// TIME_BUCKET struct - one --time-buckets interval and where its lines are
+typedef struct timeBucket {
+    long long start;          // Start of the interval, in seconds since 1970
+    long offset;              // Where this bucket's lines begin in the grouped copy
+    long size;                // Bytes of this bucket's lines in the grouped copy
+    long fill;                // Bytes copied in so far (while grouping)
+    int lineCount;            // Number of lines routed to this bucket
+} TIME_BUCKET;
+
+// BUCKET_SET struct - every bucket the file's lines fall into
+typedef struct bucketSet {
+    TIME_BUCKET *buckets;     // In first-seen order until sorted by start
+    int count;
+    int capacity;
+    int *slots;               // Open-addressing index: start -> bucket (-1 = empty)
+    int tableSize;            // Number of slots (always a power of two)
+    int skippedLines;         // Lines before the first timestamp
+} BUCKET_SET;
+
+// CODE_POINT struct - one slot of the non-ASCII code point table
+typedef struct codePoint {
+    uint32_t value;           // Unicode scalar value (0 = empty slot; never a real entry here)
+    int frequency;            // How many times it appears
+    int firstPos;             // Code point index of its first appearance
+} CODE_POINT;
+
+// CODE_POINT_STATS struct - results of UTF-8 character analysis (-cu)
+// ASCII goes through a flat 128-entry array just like -c; only multibyte
+// sequences touch the (open-addressing) code point table
+typedef struct codePointStats {
+    int asciiFrequency[ASCII_RANGE];
+    int asciiFirstPos[ASCII_RANGE];
+    CODE_POINT *table;        // Hash table of non-ASCII code points
+    int tableSize;            // Number of slots (always a power of two)
+    int tableUsed;            // Number of occupied slots
+    int totalCodePoints;      // Valid code points plus invalid sequences
+    int invalidCount;         // Number of invalid sequences
+    int firstInvalidPos;      // Code point index of the first invalid sequence
+} CODE_POINT_STATS;
+
+// WRITER struct - buffered output for --format
+// Rows are formatted straight into one large buffer that goes to fwrite when
+// it fills up, instead of several fprintf calls per row
+typedef struct writer {
+    FILE *file;
+    char *buffer;             // WRITER_BUFFER_SIZE bytes
+    size_t used;
+} WRITER;
+
+// RECORD_OUTPUT struct - a --format report being written
+// Every section is a header (name plus summary numbers) followed by rows of
+// item, count, position and length. --format bin is columnar, so it keeps
+// a section's rows here until the section ends and then writes each column
+// in one piece.
+typedef struct recordOutput {
+    WRITER writer;
+    int format;               // FORMAT_*
+    int sectionFlag;          // FLAG_* of the section being written
+    const char *section;      // Its name
+    long long summary[2];     // Its summary numbers
+    int sectionCount;         // Sections started so far
+    long rowCount;            // Rows written in the current section
+    uint32_t *counts;         // --format bin columns: one entry per row
+    uint32_t *positions;
+    uint32_t *lengths;
+    long rowCapacity;
+    char *pool;               // --format bin: the rows' items back to back
+    size_t poolUsed;
+    size_t poolCapacity;
+    uint32_t checksum;        // --format bin: CRC-32 of everything written so far
+} RECORD_OUTPUT;
+
+// FLATBUFFER struct - a flatbuffer being built for --format arrow
+// Built front to back: a table is placed first and the strings, vectors and
+// tables it points to are appended after it (flatbuffer offsets always
+// point forward), then its offset fields are patched
+typedef struct flatbuffer {
+    unsigned char *data;
+    size_t used;
+    size_t capacity;
+} FLATBUFFER;
+
+// FB_FIELD struct - one field of a flatbuffer table being built
+typedef struct fbField {
+    int size;                 // 1, 2, 4 or 8 bytes (0 = field absent)
+    uint64_t value;           // Its value (offsets are patched in later)
+    size_t position;          // Set by fbTable(): where the field was placed
+} FB_FIELD;
+
+// OPTIONS struct - everything parsed from one command (argv or a batch line)
+// parseArguments fills it in, analyzeFile reads it
+typedef struct options {
+    char *inputFile;            // Set by -f (required)
+    char *outputFile;           // Set by -o (NULL means stdout)
+    int requestCharAnalysis;    // -c
+    int requestWordAnalysis;    // -w
+    int requestLineAnalysis;    // -l
+    int requestLongestWord;     // -Lw
+    int requestLongestLine;     // -Ll
+    int requestPairAnalysis;    // -c2
+    int pairTopCount;           // --top <n>: only print the n most frequent pairs (0 = all)
+    int requestWordHistogram;   // -hw
+    int requestLineHistogram;   // -hl
+    int requestCodePointAnalysis;  // -cu
+    int ignoreCase;             // -i: case-insensitive -w/-Lw/-l/-Ll
+    int printLowercase;         // --case-print lower: print folded words/lines
+    char *extraDelims;          // --delims <chars>: more word separators (NULL = whitespace only)
+    int stripPunct;             // --strip-punct: trim punctuation off both ends of words
+    char *matchPatterns[MAX_MATCH_PATTERNS];  // --match <substring> (repeatable)
+    int matchCount;             // Number of --match patterns
+    int matchAny;               // --match-any: a line needs only one pattern, not all
+    int matchChars;             // --match-chars: restrict -c/-c2/-cu to matching lines too
+    char *regexPattern;         // --regex <pattern> (NULL = none)
+    char *stopwordFile;         // --stopwords <file> (NULL = none)
+    int countStopwords;         // --count-stopwords: include stopwords in totals/positions
+    int timeFormat;             // --time-buckets format (TS_*; 0 = no buckets)
+    long long bucketWidth;      // --time-buckets width in seconds
+    char *diffFile;             // --diff <a> <b>: the second file (inputFile is the first)
+    char *positionsFile;        // --positions <indexfile> (NULL = none)
+    int column;                 // --column <n>: count field n instead of words (0 = words)
+    char separator;             // --sep <c>: field separator for --column (default ',')
+    int presorted;              // --presorted: lines are expected in ASCII order already
+    int sortOrder;              // --sort <order>: -w/-l listing order (SORT_ALPHA if absent)
+    int sortDescending;         // --sort <order>-desc: reversed
+    int diffRank;               // --diff-rank abs|rel (DIFF_RANK_*)
+    int format;                 // --format json|jsonl|csv|tsv|bin|arrow (FORMAT_TEXT if absent)
+    char *dumpFile;             // --dump <file>: render a --format bin file (NULL = none)
+    int compress;               // --compress gzip|zstd: compress the -o file (COMPRESS_*)
+    int stats;                  // --stats: report phase times and sizes on stderr
+    int perfCounters;           // --perf-counters: report hardware counters per phase on stderr
+    int allocStats;             // --alloc-stats: report memory use by category on stderr
+    int targetFormats[MAX_OUTPUT_TARGETS];  // -o fmt:path outputs (repeatable): FORMAT_*
+    char *targetFiles[MAX_OUTPUT_TARGETS];  // ... and their paths
+    int targetCount;            // Number of -o fmt:path outputs (0 = the one -o/stdout report)
+    int flagOrder[MAX_FLAGS];   // Analysis flags in the order they appeared
+    int flagCount;              // Number of entries used in flagOrder
+} OPTIONS;
+
+// OUTPUT_TARGET struct - one report being written by analyzeFile
+// Without -o fmt:path there is exactly one: the --format report to the -o
+// file or stdout
+typedef struct outputTarget {
+    int format;                 // FORMAT_*
+    char *path;                 // NULL means stdout
+    FILE *fp;
+    pid_t compressor;           // From openOutputFile()
+} OUTPUT_TARGET;
+
+// REPORT_DATA struct - everything phase 1 of analyzeFile built, as the
+// renderers of phase 2 see it. Every target is rendered from this one copy.
+typedef struct reportData {
+    OPTIONS *options;
+    const char *fileData;
+    long dataSize;
+    int *charFrequency;
+    int *charFirstPos;
+    int uniqueCharCount;
+    int *pairFrequency;
+    CODE_POINT_STATS *codePoints;
+    TEXT_SCAN *scan;
+    WORD_TABLE *diffWords;      // --diff tables (NULL without --diff)
+    WORD_TABLE *diffLines;
+    int diffWordsA;
+    int diffLinesA;
+    int linesPresorted;         // --presorted held: -l/-Ll come from sortedLines
+    SORTED_LINES *sortedLines;
+    LINE_FILTER *scanFilter;
+    const char *bucketData;     // --time-buckets lines (NULL without buckets)
+    BUCKET_SET *buckets;
+} REPORT_DATA;
+
+// RENDER_JOB struct - one target rendered on its own thread
+typedef struct renderJob {
+    OUTPUT_TARGET *target;
+    REPORT_DATA *report;
+    pthread_t thread;
+    int threaded;               // 1 if the thread was started
+} RENDER_JOB;
+
 // =============================================================================
 // FUNCTION PROTOTYPES
 // =============================================================================
@@ -49,61 +548,281 @@ void printNoInputFileError();
 void printInputFileError();
 void printNoOutputFileError();
 void printInputFileEmptyError();
+void printInvalidTopCountError();
+void printInvalidCasePrintError();
+void printCasePrintNeedsIgnoreCaseError();
+void printTopNeedsPairsError();
+void printNoDelimitersError();
+void printNoMatchPatternError();
+void printTooManyMatchPatternsError();
+void printNoRegexError();
+void printInvalidRegexError();
+void printNoStopwordFileError();
+void printStopwordFileError();
+void printInvalidTimeBucketsError();
+void printNoDiffFilesError();
+void printInvalidDiffRankError();
+void printInvalidDiffOptionsError();
+void printNoPositionsFileError();
+void printPositionsFileError();
+void printInvalidPositionsOptionsError();
+void printInvalidColumnError();
+void printInvalidSeparatorError();
+void printInvalidSortOrderError();
+void printInvalidOrderError();
+void printInvalidFormatError();
+void printInvalidFormatOptionsError();
+void printNoDumpFileError();
+void printDumpFileError();
+void printInvalidDumpOptionsError();
+void printInvalidResultFileError();
+void printInvalidCompressError();
+void printCompressNeedsOutputError();
+void printCompressorError();
+void printOutputWriteError();
+void printTooManyOutputsError();
+void printDuplicateOutputError();
 
 // Argument parsing function
-int parseArguments(int argc, char *argv[],
-                   char **inputFile,
-                   char **outputFile,
-                   int *requestCharAnalysis,
-                   int *requestWordAnalysis,
-                   int *requestLineAnalysis,
-                   int *requestLongestWord,
-                   int *requestLongestLine,
-                   int flagOrder[],
-                   int *flagCount);
+int parseArguments(int argc, char *argv[], OPTIONS *options);
+int parseFormatName(const char *name);
+int usesStructuredOutput(OPTIONS *options);
+int samePath(const char *first, const char *second);
+int checkOutputPaths(OPTIONS *options);
 
 // Main analysis function (returns 1 on success, 0 on error)
-int analyzeFile(char *inputFile,
-                 char *outputFile,
-                 int requestCharAnalysis,
-                 int requestWordAnalysis,
-                 int requestLineAnalysis,
-                 int requestLongestWord,
-                 int requestLongestLine,
-                 int flagOrder[],
-                 int flagCount);
+int analyzeFile(OPTIONS *options);
 
 // Batch mode processing
 void processBatchFile(char *batchFilename);
 
+// MEMORY ACCOUNTING FUNCTIONS (--alloc-stats)
+void noteAllocation(int category, long long bytes, int newBlock);
+void* trackedMalloc(size_t size, int category);
+void* trackedCalloc(size_t count, size_t size, int category);
+void* trackedRealloc(void *ptr, size_t oldSize, size_t newSize, int category);
+void trackedFree(void *ptr, size_t size, int category);
+void startAllocStats(int enabled);
+void printAllocStats(FILE *outputFile);
+
 // CHARACTER ANALYSIS FUNCTIONS
-void analyzeCharacters(FILE *fp,
+char* readInputFile(FILE *fp, long fileSize, long *bytesRead);
+void analyzeCharacters(const unsigned char *data,
+                      long size,
                       int charFrequency[],
                       int charFirstPos[],
-                      int *uniqueCharCount);
+                      int *uniqueCharCount,
+                      int pairFrequency[]);
 void printCharacterAnalysis(FILE *outputFile,
                            int charFrequency[],
                            int charFirstPos[],
                            int totalCharCount,
                            int uniqueCharCount);
 
+// BYTE-PAIR ANALYSIS FUNCTIONS
+void countBytePairs(const unsigned char *buffer, size_t length, unsigned int *laneCounts);
+int comparePairIndexes(const void *a, const void *b);
+void printPairAnalysis(FILE *outputFile, int pairFrequency[],
+                       int totalPairCount, int topCount);
+
 // WORD ANALYSIS FUNCTIONS
-WORD* insertWord(WORD *head, char *word, int position);
-int countTotalWords(FILE *fp);
-WORD* buildWordList(FILE *fp, int *totalWords, int *uniqueWords);
+uint64_t foldAsciiBlock(uint64_t block);
+uint32_t hashToken(const char *token, int length, int foldCase);
+int tokensEqual(const char *stored, const char *token, int length, int foldCase);
+void initWordTable(WORD_TABLE *table, int foldCase, int printLowercase);
+void growWordTable(WORD_TABLE *table);
+void insertWord(WORD_TABLE *table, const char *word, int length, int position);
+int compareWordNodes(const void *a, const void *b);
+int compareTokens(const char *a, int lengthA, const char *b, int lengthB);
+void printToken(FILE *outputFile, const char *label, const char *text, long length);
+WORD* finishWordTable(WORD_TABLE *table);
+void sortNodesByKey(WORD **nodes, int count, int sortOrder, int descending);
+
+// POSITION INDEX FUNCTIONS
+void queuePosting(WORD_TABLE *table, WORD *node, int position);
+void flushPostings(WORD_TABLE *table);
+void addPosting(WORD *node, int position);
+void freePostings(POSTING_LIST *postings);
+void writeLittleEndian(FILE *fp, uint64_t value, int bytes);
+int writePositionIndex(const char *filename, WORD *wordHead, int uniqueWords, int alphabetical);
 void printWordAnalysis(FILE *outputFile, WORD *wordHead, int totalWords, int uniqueWords);
 void freeWordList(WORD *head);
 
 // LINE ANALYSIS FUNCTIONS
-WORD* insertLine(WORD *head, char *line, int position);
-WORD* buildLineList(FILE *fp, int *totalLines, int *uniqueLines);
+void insertLine(WORD_TABLE *table, const char *line, int length, int position);
 void printLineAnalysis(FILE *outputFile, WORD *lineHead, int totalLines, int uniqueLines);
 void freeLineList(WORD *head);
 
+// TEXT SCAN FUNCTIONS (words and lines in one pass)
+void buildCharClassTable(unsigned char charClass[], const char *extraDelims, int stripPunct);
+void addToHistogram(LENGTH_HISTOGRAM *histogram, long length);
+int countWordToken(TEXT_SCAN *scan, WORD_TABLE *wordTable, const char *word,
+                   long length, int position);
+int findField(const char *line, long length, int column, char separator,
+              char **buffer, long *bufferSize, const char **field, long *fieldLength);
+void scanText(const char *data, long size, TEXT_SCAN *scan);
+
+// STOPWORD FUNCTIONS
+int stopwordPrefilterBit(const char *word, int length, int foldCase);
+void addStopword(STOPWORD_SET *set, const char *word, int length);
+int loadStopwords(STOPWORD_SET *set, const char *filename, int foldCase);
+int isStopword(STOPWORD_SET *set, const char *word, int length);
+void freeStopwords(STOPWORD_SET *set);
+
+// TIME BUCKET FUNCTIONS
+int parseTimeBucketSpec(const char *spec, int *format, long long *width);
+int parseFixedDigits(const char *text, int count, int *value);
+long long daysFromCivil(int year, int month, int day);
+void civilFromDays(long long days, int *year, int *month, int *day);
+long parseTimestamp(const char *line, long length, int format, long long *seconds);
+void formatBucketStart(char *buffer, size_t bufferSize, long long start, int format);
+int findOrAddBucket(BUCKET_SET *set, long long start);
+char* groupLinesByBucket(const char *data, long size, int format, long long width,
+                         BUCKET_SET *set);
+int compareBuckets(const void *a, const void *b);
+void freeBucketSet(BUCKET_SET *set);
+void printTimeBuckets(FILE *outputFile, OPTIONS *options, TEXT_SCAN *baseScan,
+                      const char *grouped, BUCKET_SET *set);
+int isScanSection(int flag);
+int printScanSection(FILE *outputFile, int flag, TEXT_SCAN *scan);
+
+// DIFF FUNCTIONS
+long long diffMagnitude(const WORD *entry);
+int compareDiffEntries(const void *a, const void *b);
+int countDiffFile(const char *filename, TEXT_SCAN *scan);
+void printDiffSection(FILE *outputFile, WORD_TABLE *table, const char *itemName,
+                      const char *pluralName, int totalA, int totalB, int rankMode);
+
+// PRESORTED LINE FUNCTIONS
+int compareLineBytes(const char *a, long lengthA, const char *b, long lengthB);
+int checkSortedLines(const char *data, long size, LINE_FILTER *filter, SORTED_LINES *stats);
+int printSortedLines(FILE *outputFile, const char *data, long size, LINE_FILTER *filter,
+                     SORTED_LINES *stats, int longestOnly);
+
+// LINE FILTER FUNCTIONS
+const char* findSubstring(const char *haystack, long length,
+                          const char *needle, int needleLength);
+int lineMatches(LINE_FILTER *filter, const char *line, long length);
+char* keepMatchingLines(const char *data, long size, LINE_FILTER *filter, long *newSize);
+
+// REGEX FUNCTIONS
+int addRegexState(REGEX *regex, int type);
+int parseRegexAlternation(REGEX *regex, const char **pattern, int depth, int *end);
+int parseRegexSequence(REGEX *regex, const char **pattern, int depth, int *end);
+int parseRegexRepeat(REGEX *regex, const char **pattern, int depth, int *end);
+int parseRegexAtom(REGEX *regex, const char **pattern, int depth, int *end);
+int parseRegexClass(REGEX *regex, const char **pattern, unsigned char byteSet[]);
+void addRegexEscapeSet(char escape, unsigned char byteSet[]);
+REGEX* compileRegex(const char *pattern);
+void freeRegex(REGEX *regex);
+int addRegexClosure(REGEX *regex, int state, int atLineStart, int atLineEnd, int *count);
+int findOrAddDfaState(REGEX *regex, int *nfaStates, int count);
+void flushDfaCache(REGEX *regex);
+int buildDfaTransition(REGEX *regex, int from, int byteClass);
+int compareInts(const void *a, const void *b);
+int regexMatchesLine(REGEX *regex, const unsigned char *line, long length);
+
+// LENGTH HISTOGRAM FUNCTIONS
+void printLengthHistogram(FILE *outputFile, LENGTH_HISTOGRAM *histogram,
+                          const char *itemName, const char *pluralName);
+
+// UTF-8 CODE POINT FUNCTIONS
+int decodeUtf8(const unsigned char *bytes, long available, uint32_t *codePoint);
+void addCodePoint(CODE_POINT_STATS *stats, uint32_t value, int position);
+void analyzeCodePoints(const unsigned char *data, long size, const int *asciiCounts,
+                       CODE_POINT_STATS *stats);
+int compareCodePoints(const void *a, const void *b);
+void printCodePointAnalysis(FILE *outputFile, CODE_POINT_STATS *stats);
+
 // LONGEST WORD/LINE FUNCTIONS
+WORD** collectLongest(WORD *head, int *maxLength, int *count);
 void printLongestWord(FILE *outputFile, WORD *wordHead);
 void printLongestLine(FILE *outputFile, WORD *lineHead);
 
+// STRUCTURED OUTPUT FUNCTIONS
+void initWriter(WRITER *writer, FILE *file);
+void flushWriter(WRITER *writer);
+void writeBytes(WRITER *writer, const char *data, size_t length);
+void writeText(WRITER *writer, const char *text);
+void writeInteger(WRITER *writer, long long value);
+uint64_t blockMatchesByte(uint64_t block, unsigned char value);
+int blockNeedsEscape(uint64_t block);
+void writeJsonString(WRITER *writer, const char *text, size_t length);
+int fieldNeedsQuoting(const char *text, size_t length, int format);
+void writeDelimitedField(WRITER *writer, const char *text, size_t length, int format);
+void freeWriter(WRITER *writer);
+const char* recordSectionName(int flag);
+void beginRecords(RECORD_OUTPUT *out, FILE *file, int format, const char *inputFile);
+void beginRecordSection(RECORD_OUTPUT *out, int flag,
+                        const char *firstKey, long long firstValue,
+                        const char *secondKey, long long secondValue);
+void writeRecordRow(RECORD_OUTPUT *out, const char *item, size_t itemLength,
+                    long long count, long long position, long long length);
+void endRecordSection(RECORD_OUTPUT *out);
+void endRecords(RECORD_OUTPUT *out);
+void writeCharRecords(RECORD_OUTPUT *out, int charFrequency[], int charFirstPos[],
+                      int totalCharCount, int uniqueCharCount);
+void writeListRecords(RECORD_OUTPUT *out, int flag, WORD *head, int total, int unique);
+void writeLongestRecords(RECORD_OUTPUT *out, int flag, WORD *head);
+void writeStructuredReport(FILE *outputFile, OPTIONS *options, int format,
+                           int charFrequency[], int charFirstPos[], int totalCharCount,
+                           int uniqueCharCount, TEXT_SCAN *scan);
+
+// RESULT FILE FUNCTIONS (--format bin, --dump)
+uint32_t updateCrc32(uint32_t crc, const void *data, size_t length);
+void writeResultBytes(RECORD_OUTPUT *out, const void *data, size_t length);
+void writeResultNumber(RECORD_OUTPUT *out, uint64_t value, int bytes);
+void writeResultColumn(RECORD_OUTPUT *out, const uint32_t *values, long count);
+void addResultRow(RECORD_OUTPUT *out, const char *item, size_t itemLength,
+                  long long count, long long position, long long length);
+void writeResultSection(RECORD_OUTPUT *out);
+uint64_t readLittleEndian(const unsigned char *bytes, int count);
+int renderResultFile(FILE *outputFile, const unsigned char *data, size_t size);
+int dumpResultFile(const char *filename, const char *outputFilename);
+
+// OUTPUT FILE FUNCTIONS
+FILE* openOutputFile(const char *filename, int compress, pid_t *compressor);
+int closeOutputFile(FILE *fp, pid_t compressor);
+int collectOutputTargets(OPTIONS *options, OUTPUT_TARGET targets[]);
+int openOutputTargets(OUTPUT_TARGET targets[], int count, int compress);
+int closeOutputTargets(OUTPUT_TARGET targets[], int count);
+
+// RUN STATISTICS FUNCTIONS (--stats)
+double secondsBetween(struct timespec start, struct timespec end);
+void startRunStats(RUN_STATS *stats, int perfCounters);
+void markPhase(RUN_STATS *stats, int phase);
+void noteTableSize(RUN_STATS *stats, WORD_TABLE *wordTable, WORD_TABLE *lineTable);
+void printRunStats(FILE *outputFile, RUN_STATS *stats, REPORT_DATA *report);
+void printUniqueCount(FILE *outputFile, const char *label, int total, int unique, int counted);
+int openPerfCounters();
+void readPerfCounters(uint64_t values[]);
+void printPerfCount(FILE *outputFile, const char *name, uint64_t count, int event);
+void printPerfCounters(FILE *outputFile, RUN_STATS *stats);
+
+// REPORT RENDERING FUNCTIONS (phase 2 of analyzeFile)
+void printTextReport(FILE *outputFile, REPORT_DATA *report);
+void renderTarget(OUTPUT_TARGET *target, REPORT_DATA *report);
+void* renderTargetThread(void *job);
+void renderTargets(OUTPUT_TARGET targets[], int count, REPORT_DATA *report);
+
+// ARROW OUTPUT FUNCTIONS
+size_t fbAppend(FLATBUFFER *fb, const void *bytes, size_t length, size_t alignment);
+void fbPutNumber(FLATBUFFER *fb, size_t position, uint64_t value, int bytes);
+void fbPatch(FLATBUFFER *fb, size_t fieldPosition, size_t target);
+size_t fbTable(FLATBUFFER *fb, FB_FIELD fields[], int count);
+size_t fbString(FLATBUFFER *fb, const char *text);
+size_t fbVector(FLATBUFFER *fb, const unsigned char *elements, int count, int elementSize);
+size_t fbIntType(FLATBUFFER *fb, int bitWidth, int isSigned);
+size_t fbArrowField(FLATBUFFER *fb, const char *name, int isString, int dictionary);
+size_t fbArrowMessage(FLATBUFFER *fb, int headerType, long long bodyLength);
+void buildArrowSchema(FLATBUFFER *fb);
+void buildArrowBatch(FLATBUFFER *fb, int dictionaryId, long long rows,
+                     const long long buffers[][2], int bufferCount, long long bodyLength);
+void writeArrowMessage(RECORD_OUTPUT *out, FLATBUFFER *fb);
+void writeArrowPadding(RECORD_OUTPUT *out, long long length);
+void writeArrowStart(RECORD_OUTPUT *out);
+void writeArrowBatch(RECORD_OUTPUT *out);
+
 // =============================================================================
 // MAIN PROGRAM
 // =============================================================================
@@ -122,27 +841,10 @@ int main(int argc, char *argv[]) {
         return 0;
     } else {
         // Single-run mode: parse arguments and analyze one file
-        char *inputFile = NULL;
-        char *outputFile = NULL;
-        int requestCharAnalysis = 0;
-        int requestWordAnalysis = 0;
-        int requestLineAnalysis = 0;
-        int requestLongestWord = 0;
-        int requestLongestLine = 0;
-        int flagOrder[MAX_FLAGS];
-        int flagCount = 0;
+        OPTIONS options;
 
         // Parse and validate all arguments
-        int parseResult = parseArguments(argc, argv,
-                                        &inputFile,
-                                        &outputFile,
-                                        &requestCharAnalysis,
-                                        &requestWordAnalysis,
-                                        &requestLineAnalysis,
-                                        &requestLongestWord,
-                                        &requestLongestLine,
-                                        flagOrder,
-                                        &flagCount);
+        int parseResult = parseArguments(argc, argv, &options);
 
         if (parseResult == 0) {
             // Error in arguments - parseArguments already printed error message
@@ -150,14 +852,7 @@ int main(int argc, char *argv[]) {
         }
 
         // If we get here, arguments are valid - analyze the file
-        int analyzeResult = analyzeFile(inputFile, outputFile,
-                                       requestCharAnalysis,
-                                       requestWordAnalysis,
-                                       requestLineAnalysis,
-                                       requestLongestWord,
-                                       requestLongestLine,
-                                       flagOrder,
-                                       flagCount);
+        int analyzeResult = analyzeFile(&options);
 
         // Return 0 if successful, 1 if error from analyzeFile
         return (analyzeResult == 1) ? 0 : 1;
@@ -203,135 +898,590 @@ void printInputFileEmptyError() {
     printf("ERROR: Input File Empty\n");
 }
 
+void printInvalidTopCountError() {
+    printf("ERROR: Invalid Top Count\n");
+}
+
+void printTopNeedsPairsError() {
+    printf("ERROR: Top Needs -c2\n");
+}
+
+void printCasePrintNeedsIgnoreCaseError() {
+    printf("ERROR: Case Print Needs -i\n");
+}
+
+void printInvalidCasePrintError() {
+    printf("ERROR: Invalid Case Print Mode\n");
+}
+
+void printNoDelimitersError() {
+    printf("ERROR: No Delimiters Provided\n");
+}
+
+void printNoMatchPatternError() {
+    printf("ERROR: No Match Pattern Provided\n");
+}
+
+void printTooManyMatchPatternsError() {
+    printf("ERROR: Too Many Match Patterns\n");
+}
+
+void printNoRegexError() {
+    printf("ERROR: No Regex Provided\n");
+}
+
+void printInvalidRegexError() {
+    printf("ERROR: Invalid Regex\n");
+}
+
+void printNoStopwordFileError() {
+    printf("ERROR: No Stopword File Provided\n");
+}
+
+void printStopwordFileError() {
+    printf("ERROR: Can't open stopword file\n");
+}
+
+void printInvalidTimeBucketsError() {
+    printf("ERROR: Invalid Time Buckets\n");
+}
+
+void printNoDiffFilesError() {
+    printf("ERROR: Diff Needs Two Files\n");
+}
+
+void printInvalidDiffRankError() {
+    printf("ERROR: Invalid Diff Rank\n");
+}
+
+void printInvalidDiffOptionsError() {
+    printf("ERROR: Diff Supports Only -w and -l\n");
+}
+
+void printNoPositionsFileError() {
+    printf("ERROR: No Positions File Provided\n");
+}
+
+void printPositionsFileError() {
+    printf("ERROR: Can't open positions file\n");
+}
+
+void printInvalidPositionsOptionsError() {
+    printf("ERROR: Positions Not Supported With Diff or Time Buckets\n");
+}
+
+void printInvalidColumnError() {
+    printf("ERROR: Invalid Column\n");
+}
+
+void printInvalidSeparatorError() {
+    printf("ERROR: Invalid Separator\n");
+}
+
+void printInvalidSortOrderError() {
+    printf("ERROR: Invalid Sort Order\n");
+}
+
+void printInvalidOrderError() {
+    printf("ERROR: Invalid Order\n");
+}
+
+void printInvalidFormatError() {
+    printf("ERROR: Invalid Format\n");
+}
+
+void printInvalidFormatOptionsError() {
+    printf("ERROR: Format Supports Only -c, -w, -l, -Lw and -Ll\n");
+}
+
+void printNoDumpFileError() {
+    printf("ERROR: No Dump File Provided\n");
+}
+
+void printDumpFileError() {
+    printf("ERROR: Can't open dump file\n");
+}
+
+void printInvalidDumpOptionsError() {
+    printf("ERROR: Dump Takes Only -o\n");
+}
+
+void printInvalidResultFileError() {
+    printf("ERROR: Invalid Result File\n");
+}
+
+void printInvalidCompressError() {
+    printf("ERROR: Invalid Compressor\n");
+}
+
+void printCompressNeedsOutputError() {
+    printf("ERROR: Compress Needs -o\n");
+}
+
+void printCompressorError() {
+    printf("ERROR: Compressor failed\n");
+}
+
+void printOutputWriteError() {
+    printf("ERROR: Can't write output file\n");
+}
+
+void printTooManyOutputsError() {
+    printf("ERROR: Too Many Output Files\n");
+}
+
+void printDuplicateOutputError() {
+    printf("ERROR: Duplicate Output File\n");
+}
+
+// =============================================================================
+// MEMORY ACCOUNTING FUNCTIONS
+// =============================================================================
+// The big allocations (everything that grows with the input) go through
+// these wrappers. The caller says what each block is for and, when freeing
+// it, how big it was, so no size header is kept per block. Without
+// --alloc-stats the only cost is testing allocAccounting.
+
+// Category names for --alloc-stats, indexed by MEM_*
+const char *memCategoryNames[MEM_CATEGORY_COUNT] = {
+    "nodes", "strings", "tables", "buffers", "sort"
+};
+
+int allocAccounting = 0;                      // --alloc-stats is on for this run
+MEM_CATEGORY memCategories[MEM_CATEGORY_COUNT];
+MEM_CATEGORY memTotal;                        // All categories together
+pthread_mutex_t memLock = PTHREAD_MUTEX_INITIALIZER;   // -o fan-out renderers allocate too
+
+// noteAllocation - Counts bytes allocated (or, negative, freed) in a category
+void noteAllocation(int category, long long bytes, int newBlock) {
+    pthread_mutex_lock(&memLock);
+    MEM_CATEGORY *totals[2] = { &memCategories[category], &memTotal };
+    for (int i = 0; i < 2; i++) {
+        totals[i]->allocations += newBlock;
+        totals[i]->live += bytes;
+        if (bytes > 0) {
+            totals[i]->allocated += bytes;
+        }
+        if (totals[i]->live > totals[i]->peak) {
+            totals[i]->peak = totals[i]->live;
+        }
+    }
+    pthread_mutex_unlock(&memLock);
+}
+
+// trackedMalloc - malloc() counted under a MEM_* category
+void* trackedMalloc(size_t size, int category) {
+    void *ptr = malloc(size);
+    if (allocAccounting && ptr != NULL) {
+        noteAllocation(category, (long long)size, 1);
+    }
+    return ptr;
+}
+
+// trackedCalloc - calloc() counted under a MEM_* category
+void* trackedCalloc(size_t count, size_t size, int category) {
+    void *ptr = calloc(count, size);
+    if (allocAccounting && ptr != NULL) {
+        noteAllocation(category, (long long)(count * size), 1);
+    }
+    return ptr;
+}
+
+// trackedRealloc - realloc() counted under a MEM_* category
+// oldSize: What ptr was allocated with (0 if ptr is NULL)
+void* trackedRealloc(void *ptr, size_t oldSize, size_t newSize, int category) {
+    void *newPtr = realloc(ptr, newSize);
+    if (allocAccounting && newPtr != NULL) {
+        noteAllocation(category, (long long)newSize - (long long)oldSize, 1);
+    }
+    return newPtr;
+}
+
+// trackedFree - free() of a block from the tracked functions
+// size: What it was allocated with
+void trackedFree(void *ptr, size_t size, int category) {
+    if (allocAccounting && ptr != NULL) {
+        noteAllocation(category, -(long long)size, 0);
+    }
+    free(ptr);
+}
+
+// startAllocStats - Clears the totals for one run (or one batch entry) and
+// turns counting on or off for it
+void startAllocStats(int enabled) {
+    memset(memCategories, 0, sizeof(memCategories));
+    memset(&memTotal, 0, sizeof(memTotal));
+    allocAccounting = enabled;
+}
+
+// printAllocStats - Prints the --alloc-stats report and stops counting
+// Live is what was still allocated when the run ended (0 unless something
+// leaked)
+void printAllocStats(FILE *outputFile) {
+    allocAccounting = 0;
+    fprintf(outputFile, "Memory:\n");
+    for (int i = 0; i <= MEM_CATEGORY_COUNT; i++) {
+        MEM_CATEGORY *category = (i < MEM_CATEGORY_COUNT) ? &memCategories[i] : &memTotal;
+        fprintf(outputFile, "Category: %s, Allocations: %lld, Allocated: %lld bytes, "
+                "Peak: %lld bytes, Live: %lld bytes\n",
+                (i < MEM_CATEGORY_COUNT) ? memCategoryNames[i] : "total",
+                category->allocations, category->allocated, category->peak, category->live);
+    }
+}
+
 // =============================================================================
 // WORD ANALYSIS FUNCTIONS
 // =============================================================================
 
-// insertWord - Inserts a word into an alphabetically sorted doubly-linked list
+// foldAsciiBlock - Lowercases the ASCII letters in eight bytes at once
+// For each byte, the high bit of (b + (0x80 - 'A')) says b >= 'A' and the
+// high bit of (b + (0x7F - 'Z')) says b > 'Z'; working on the low seven bits
+// keeps the additions from carrying into the next byte. Bytes that are not
+// ASCII (high bit set) are left alone, and 0x20 is added to the rest.
+uint64_t foldAsciiBlock(uint64_t block) {
+    const uint64_t lowSeven = 0x7F7F7F7F7F7F7F7FULL;
+    const uint64_t highBits = 0x8080808080808080ULL;
+    uint64_t heptets = block & lowSeven;
+    uint64_t atLeastA = heptets + 0x3F3F3F3F3F3F3F3FULL;    // 0x80 - 'A' per byte
+    uint64_t aboveZ = heptets + 0x2525252525252525ULL;      // 0x7F - 'Z' per byte
+    uint64_t isUpper = (atLeastA ^ aboveZ) & ~block & highBits;
+    return block | (isUpper >> 2);
+}
+
+// hashToken - Hashes a word or line eight bytes at a time
+// With foldCase set, each block is lowercased (foldAsciiBlock) on its way
+// into the hash, so case-insensitive counting needs no folded copy of the
+// token. The final partial block is zero-padded.
+uint32_t hashToken(const char *token, int length, int foldCase) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ (uint64_t)length;
+    int pos = 0;
+
+    for (; pos + 8 <= length; pos += 8) {
+        uint64_t block;
+        memcpy(&block, token + pos, sizeof(block));
+        if (foldCase) {
+            block = foldAsciiBlock(block);
+        }
+        hash = (hash ^ block) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    if (pos < length) {
+        uint64_t block = 0;
+        memcpy(&block, token + pos, (size_t)(length - pos));
+        if (foldCase) {
+            block = foldAsciiBlock(block);
+        }
+        hash = (hash ^ block) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    return (uint32_t)(hash >> 32);
+}
+
+// tokensEqual - Compares a stored entry with a token of the same length
+// Returns 1 if equal (ignoring ASCII case when foldCase is set), 0 otherwise
+int tokensEqual(const char *stored, const char *token, int length, int foldCase) {
+    if (!foldCase) {
+        return memcmp(stored, token, (size_t)length) == 0;
+    }
+    for (int i = 0; i < length; i++) {
+        unsigned char a = (unsigned char)stored[i];
+        unsigned char b = (unsigned char)token[i];
+        if (a >= 'A' && a <= 'Z') {
+            a += 'a' - 'A';
+        }
+        if (b >= 'A' && b <= 'Z') {
+            b += 'a' - 'A';
+        }
+        if (a != b) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// initWordTable - Sets up an empty word/line table
+void initWordTable(WORD_TABLE *table, int foldCase, int printLowercase) {
+    table->tableSize = WORD_TABLE_START;
+    table->slots = (WORD **)trackedCalloc((size_t)table->tableSize, sizeof(WORD *), MEM_TABLES);
+    if (table->slots == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+    table->uniqueCount = 0;
+    table->head = NULL;
+    table->tail = NULL;
+    table->foldCase = foldCase;
+    table->printLowercase = printLowercase;
+    table->countSecond = 0;
+    table->recordPositions = 0;
+    table->sortOrder = SORT_ALPHA;
+    table->sortDescending = 0;
+    table->pendingNodes = NULL;
+    table->pendingPositions = NULL;
+    table->pendingCount = 0;
+}
+
+// growWordTable - Doubles the number of slots and re-inserts every node
+// Uses the hash saved in each node, so no string is rehashed
+void growWordTable(WORD_TABLE *table) {
+    int newSize = table->tableSize * 2;
+    WORD **newSlots = (WORD **)trackedCalloc((size_t)newSize, sizeof(WORD *), MEM_TABLES);
+    if (newSlots == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+
+    uint32_t mask = (uint32_t)(newSize - 1);
+    for (WORD *current = table->head; current != NULL; current = current->nextWord) {
+        uint32_t slot = current->hashValue & mask;
+        while (newSlots[slot] != NULL) {
+            slot = (slot + 1) & mask;
+        }
+        newSlots[slot] = current;
+    }
+
+    trackedFree(table->slots, sizeof(WORD *) * (size_t)table->tableSize, MEM_TABLES);
+    table->slots = newSlots;
+    table->tableSize = newSize;
+}
+
+// insertWord - Counts one occurrence of a word in a word table
 // Handles both new words and duplicate words
 // Parameters:
-//   head: Pointer to the first node in the list (may be NULL for empty list)
-//   word: The word to insert
+//   table: The table to count into (see initWordTable)
+//   word: The word to insert (does not need to be NUL-terminated)
+//   length: Number of bytes in word
 //   position: The position (0-indexed) of this word in the file
-// Returns: Pointer to the head of the list (will change if inserting at beginning)
-WORD* insertWord(WORD *head, char *word, int position) {
-    // First, check if this word already exists in the list
-    WORD *current = head;
-    while (current != NULL) {
-        // Compare current word with the word we're trying to insert
-        if (strcmp(current->contents, word) == 0) {
+void insertWord(WORD_TABLE *table, const char *word, int length, int position) {
+    uint32_t hashValue = hashToken(word, length, table->foldCase);
+    uint32_t mask = (uint32_t)(table->tableSize - 1);
+    uint32_t slot = hashValue & mask;
+
+    // First, check if this word already exists in the table
+    while (table->slots[slot] != NULL) {
+        WORD *current = table->slots[slot];
+        if (current->hashValue == hashValue && current->numChars == length &&
+            tokensEqual(current->contents, word, length, table->foldCase)) {
             // DUPLICATE WORD FOUND!
             // Increment frequency, don't change position
-            current->frequency++;
-            return head;  // Don't change list structure
+            if (table->countSecond) {
+                current->frequencyB++;
+            } else {
+                current->frequency++;
+            }
+            if (table->recordPositions) {
+                queuePosting(table, current, position);
+            }
+            return;
         }
-
-        // Not found yet, move to next node
-        current = current->nextWord;
+        slot = (slot + 1) & mask;
     }
 
     // Word not found - create a new node
-    WORD *newNode = (WORD *)malloc(sizeof(WORD));
+    WORD *newNode = (WORD *)trackedMalloc(sizeof(WORD), MEM_NODES);
     if (newNode == NULL) {
         printf("ERROR: Memory allocation failed\n");
         exit(1);
     }
 
     // Allocate memory for the string content and copy it
-    newNode->contents = (char *)malloc(strlen(word) + 1);
+    // (lowercased here, once per unique word, for --case-print lower)
+    newNode->contents = (char *)trackedMalloc((size_t)length + 1, MEM_STRINGS);
     if (newNode->contents == NULL) {
         printf("ERROR: Memory allocation failed\n");
-        free(newNode);
+        trackedFree(newNode, sizeof(WORD), MEM_NODES);
         exit(1);
     }
-    strcpy(newNode->contents, word);
+    memcpy(newNode->contents, word, (size_t)length);
+    newNode->contents[length] = '\0';
+    if (table->foldCase && table->printLowercase) {
+        for (int i = 0; i < length; i++) {
+            if (newNode->contents[i] >= 'A' && newNode->contents[i] <= 'Z') {
+                newNode->contents[i] += 'a' - 'A';
+            }
+        }
+    }
 
-    // Initialize the new node
-    newNode->numChars = strlen(word);
-    newNode->frequency = 1;
+    // Initialize the new node and append it to the list
+    newNode->numChars = length;
+    newNode->frequency = !table->countSecond;
+    newNode->frequencyB = table->countSecond;
     newNode->orderAppeared = position;
+    newNode->hashValue = hashValue;
+    newNode->postings = NULL;
+    if (table->recordPositions) {
+        queuePosting(table, newNode, position);
+    }
     newNode->nextWord = NULL;
-    newNode->prevWord = NULL;
-
-    // If list is empty, this becomes the head
-    if (head == NULL) {
-        return newNode;
+    newNode->prevWord = table->tail;
+    if (table->tail != NULL) {
+        table->tail->nextWord = newNode;
+    } else {
+        table->head = newNode;
     }
+    table->tail = newNode;
 
-    // Find the correct position to insert (maintain alphabetical order)
-    current = head;
-    while (current->nextWord != NULL && strcmp(current->contents, word) < 0) {
-        // Keep moving forward while current word comes before new word alphabetically
-        current = current->nextWord;
+    table->slots[slot] = newNode;
+    table->uniqueCount++;
+
+    // Keep the table at most half full so probe runs stay short
+    if (table->uniqueCount * 2 > table->tableSize) {
+        growWordTable(table);
     }
+}
 
-    // Check if we need to insert before the current node
-    if (strcmp(current->contents, word) > 0) {
-        // Insert before current
-        newNode->nextWord = current;
-        newNode->prevWord = current->prevWord;
+// compareWordNodes - qsort comparator: ASCII alphabetical order of contents
+int compareWordNodes(const void *a, const void *b) {
+    const WORD *nodeA = *(WORD * const *)a;
+    const WORD *nodeB = *(WORD * const *)b;
+    return compareTokens(nodeA->contents, nodeA->numChars, nodeB->contents, nodeB->numChars);
+}
 
-        if (current->prevWord != NULL) {
-            current->prevWord->nextWord = newNode;
-        }
-        current->prevWord = newNode;
+// compareTokens - ASCII order of two words or lines, every byte counted
+// Words and lines are kept whole, embedded NULs included, so they are
+// compared (and printed, see printToken) by length rather than as C
+// strings. For text without NULs this is the same order as strcmp().
+int compareTokens(const char *a, int lengthA, const char *b, int lengthB) {
+    int result = memcmp(a, b, (size_t)((lengthA < lengthB) ? lengthA : lengthB));
+    if (result != 0) {
+        return result;
+    }
+    return (lengthA > lengthB) - (lengthA < lengthB);
+}
 
-        // If current was the head, newNode becomes the new head
-        if (current == head) {
-            return newNode;
-        }
-        return head;
-    } else {
-        // Insert after current
-        newNode->prevWord = current;
-        newNode->nextWord = current->nextWord;
+// printToken - Prints a label and then a word or line, all length bytes of
+// it (embedded NULs included, where %s would stop)
+void printToken(FILE *outputFile, const char *label, const char *text, long length) {
+    fputs(label, outputFile);
+    fwrite(text, 1, (size_t)length, outputFile);
+}
 
-        if (current->nextWord != NULL) {
-            current->nextWord->prevWord = newNode;
-        }
-        current->nextWord = newNode;
+// finishWordTable - Ends counting: sorts the list (alphabetically, unless
+// --sort asked for another order) and frees the hash slots
+// With --order first-seen the list is returned as built: nodes are appended
+// as they are first seen, so it is already in orderAppeared order
+// Returns: Head of the sorted doubly-linked list (NULL if the table is empty)
+WORD* finishWordTable(WORD_TABLE *table) {
+    trackedFree(table->slots, sizeof(WORD *) * (size_t)table->tableSize, MEM_TABLES);
+    table->slots = NULL;
+    if (table->recordPositions) {
+        flushPostings(table);
+        trackedFree(table->pendingNodes, sizeof(WORD *) * POSTING_BATCH, MEM_BUFFERS);
+        trackedFree(table->pendingPositions, sizeof(int) * POSTING_BATCH, MEM_BUFFERS);
+        table->pendingNodes = NULL;
+        table->pendingPositions = NULL;
+    }
 
-        return head;
+    if (table->uniqueCount == 0) {
+        return NULL;
+    }
+    if (table->sortOrder == SORT_NONE) {
+        return table->head;
     }
-}
 
-// countTotalWords - Counts the total number of words in the file
-int countTotalWords(FILE *fp) {
+    // Gather the nodes, sort them, and relink them in the new order
+    WORD **nodes = (WORD **)trackedMalloc(sizeof(WORD *) * table->uniqueCount, MEM_SORT);
+    if (nodes == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
     int count = 0;
-    char buffer[MAX_WORD_LENGTH];
+    for (WORD *current = table->head; current != NULL; current = current->nextWord) {
+        nodes[count++] = current;
+    }
+    if (table->sortOrder == SORT_ALPHA) {
+        qsort(nodes, count, sizeof(WORD *), compareWordNodes);
+        if (table->sortDescending) {
+            for (int i = 0; i < count / 2; i++) {
+                WORD *temp = nodes[i];
+                nodes[i] = nodes[count - 1 - i];
+                nodes[count - 1 - i] = temp;
+            }
+        }
+    } else {
+        sortNodesByKey(nodes, count, table->sortOrder, table->sortDescending);
+    }
 
-    // Use fscanf to read whitespace-separated words
-    while (fscanf(fp, "%s", buffer) == 1) {
-        count++;
+    for (int i = 0; i < count; i++) {
+        nodes[i]->prevWord = (i > 0) ? nodes[i - 1] : NULL;
+        nodes[i]->nextWord = (i + 1 < count) ? nodes[i + 1] : NULL;
     }
+    table->head = nodes[0];
+    table->tail = nodes[count - 1];
 
-    return count;
+    trackedFree(nodes, sizeof(WORD *) * (size_t)count, MEM_SORT);
+    return table->head;
 }
 
-// buildWordList - Creates a linked list of all unique words with their frequencies
-WORD* buildWordList(FILE *fp, int *totalWords, int *uniqueWords) {
-    WORD *head = NULL;
-    char buffer[MAX_WORD_LENGTH];
-    int wordIndex = 0;  // Track which word we're on (0-indexed)
+// sortNodesByKey - Sorts nodes for --sort freq|first|len (and -desc)
+// Each node gets a 64-bit key: the sort value in the high 32 bits (inverted
+// for descending) and its first position in the low 32 bits, so ties keep
+// first-seen order and every key is distinct. The keys are then sorted with
+// an LSD radix sort, one byte per pass, so the cost doesn't depend on
+// string comparisons. Passes where every key has the same byte (the high
+// bytes of small counts, usually) are skipped.
+void sortNodesByKey(WORD **nodes, int count, int sortOrder, int descending) {
+    SORT_KEY *keys = (SORT_KEY *)trackedMalloc(sizeof(SORT_KEY) * (size_t)count, MEM_SORT);
+    SORT_KEY *scratch = (SORT_KEY *)trackedMalloc(sizeof(SORT_KEY) * (size_t)count, MEM_SORT);
+    size_t (*histogram)[BYTE_RANGE] = (size_t (*)[BYTE_RANGE])trackedCalloc(8, sizeof(*histogram),
+                                                                            MEM_SORT);
+    if (keys == NULL || scratch == NULL || histogram == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
 
-    *totalWords = 0;
-    *uniqueWords = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t primary;
+        if (sortOrder == SORT_FREQ) {
+            primary = (uint32_t)nodes[i]->frequency;
+        } else if (sortOrder == SORT_LEN) {
+            primary = (uint32_t)nodes[i]->numChars;
+        } else {
+            primary = (uint32_t)nodes[i]->orderAppeared;
+        }
+        if (descending) {
+            primary = UINT32_MAX - primary;
+        }
+        keys[i].key = ((uint64_t)primary << 32) | (uint32_t)nodes[i]->orderAppeared;
+        keys[i].node = nodes[i];
 
-    // Read each word from the file
-    while (fscanf(fp, "%s", buffer) == 1) {
-        (*totalWords)++;
-        head = insertWord(head, buffer, wordIndex);
-        wordIndex++;  // Move to next word position
+        // Count every digit of every key in the same pass
+        for (int digit = 0; digit < 8; digit++) {
+            histogram[digit][(keys[i].key >> (8 * digit)) & 0xFF]++;
+        }
     }
 
-    // Count unique words by traversing the list
-    WORD *current = head;
-    while (current != NULL) {
-        (*uniqueWords)++;
-        current = current->nextWord;
+    for (int digit = 0; digit < 8; digit++) {
+        size_t *counts = histogram[digit];
+        if (counts[(keys[0].key >> (8 * digit)) & 0xFF] == (size_t)count) {
+            continue;   // Every key has the same byte here
+        }
+
+        // Turn counts into starting offsets, then scatter
+        size_t offset = 0;
+        for (int b = 0; b < BYTE_RANGE; b++) {
+            size_t bucketCount = counts[b];
+            counts[b] = offset;
+            offset += bucketCount;
+        }
+        for (int i = 0; i < count; i++) {
+            scratch[counts[(keys[i].key >> (8 * digit)) & 0xFF]++] = keys[i];
+        }
+
+        SORT_KEY *swap = keys;
+        keys = scratch;
+        scratch = swap;
     }
 
-    return head;
+    for (int i = 0; i < count; i++) {
+        nodes[i] = keys[i].node;
+    }
+
+    trackedFree(keys, sizeof(SORT_KEY) * (size_t)count, MEM_SORT);
+    trackedFree(scratch, sizeof(SORT_KEY) * (size_t)count, MEM_SORT);
+    trackedFree(histogram, 8 * sizeof(*histogram), MEM_SORT);
 }
 
 // printWordAnalysis - Prints word statistics
@@ -342,8 +1492,9 @@ void printWordAnalysis(FILE *outputFile, WORD *wordHead, int totalWords, int uni
     // List is already sorted alphabetically, so just traverse and print
     WORD *current = wordHead;
     while (current != NULL) {
-        fprintf(outputFile, "Word: %s, Freq: %d, Initial Position: %d\n",
-               current->contents, current->frequency, current->orderAppeared);
+        printToken(outputFile, "Word: ", current->contents, current->numChars);
+        fprintf(outputFile, ", Freq: %d, Initial Position: %d\n",
+               current->frequency, current->orderAppeared);
         current = current->nextWord;
     }
 }
@@ -354,9 +1505,196 @@ void freeWordList(WORD *head) {
     while (current != NULL) {
         WORD *temp = current;
         current = current->nextWord;
-        free(temp->contents);  // Free the string
-        free(temp);            // Free the node
+        trackedFree(temp->contents, (size_t)temp->numChars + 1, MEM_STRINGS);  // Free the string
+        freePostings(temp->postings);
+        trackedFree(temp, sizeof(WORD), MEM_NODES);                            // Free the node
+    }
+}
+
+// =============================================================================
+// POSITION INDEX FUNCTIONS
+// =============================================================================
+
+// queuePosting - Records one occurrence for the posting lists
+// Occurrences are queued and added in batches: appending to a posting list
+// in between every two hash lookups makes the lists and the table fight
+// over the cache, and batching roughly halves the cost of --positions.
+void queuePosting(WORD_TABLE *table, WORD *node, int position) {
+    if (table->pendingNodes == NULL) {
+        table->pendingNodes = (WORD **)trackedMalloc(sizeof(WORD *) * POSTING_BATCH, MEM_BUFFERS);
+        table->pendingPositions = (int *)trackedMalloc(sizeof(int) * POSTING_BATCH, MEM_BUFFERS);
+        if (table->pendingNodes == NULL || table->pendingPositions == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+    } else if (table->pendingCount == POSTING_BATCH) {
+        flushPostings(table);
+    }
+    table->pendingNodes[table->pendingCount] = node;
+    table->pendingPositions[table->pendingCount] = position;
+    table->pendingCount++;
+}
+
+// flushPostings - Adds every queued occurrence to its word's posting list
+void flushPostings(WORD_TABLE *table) {
+    for (int i = 0; i < table->pendingCount; i++) {
+        addPosting(table->pendingNodes[i], table->pendingPositions[i]);
     }
+    table->pendingCount = 0;
+}
+
+// addPosting - Appends one occurrence to a word's posting list
+// Each position is stored as the gap from the previous one in LEB128 varint
+// form (7 bits per byte, high bit = more bytes follow). Blocks start small
+// and double in size, so rare words waste little memory and frequent words
+// don't need a malloc every few occurrences. The first block is allocated
+// together with the list itself.
+void addPosting(WORD *node, int position) {
+    POSTING_LIST *list = node->postings;
+    if (list == NULL) {
+        list = (POSTING_LIST *)trackedCalloc(1, sizeof(POSTING_LIST) + sizeof(POSTING_BLOCK) +
+                                                POSTING_BLOCK_START, MEM_NODES);
+        if (list == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+        list->first = (POSTING_BLOCK *)(list + 1);
+        list->first->capacity = POSTING_BLOCK_START;
+        list->last = list->first;
+        node->postings = list;
+    }
+
+    // Make sure the longest possible varint fits in the last block
+    POSTING_BLOCK *block = list->last;
+    if (block->capacity - block->used < MAX_VARINT_BYTES) {
+        int capacity = (block->capacity < POSTING_BLOCK_MAX) ? block->capacity * 2
+                                                             : POSTING_BLOCK_MAX;
+
+        size_t blockSize = sizeof(POSTING_BLOCK) + (size_t)capacity;
+        POSTING_BLOCK *newBlock = (POSTING_BLOCK *)trackedMalloc(blockSize, MEM_NODES);
+        if (newBlock == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+        newBlock->next = NULL;
+        newBlock->capacity = capacity;
+        newBlock->used = 0;
+        block->next = newBlock;
+        list->last = newBlock;
+        block = newBlock;
+    }
+
+    uint32_t gap = (uint32_t)(position - list->lastPosition);
+    int start = block->used;
+    while (gap >= 0x80) {
+        block->data[block->used++] = (unsigned char)(gap | 0x80);
+        gap >>= 7;
+    }
+    block->data[block->used++] = (unsigned char)gap;
+
+    list->totalBytes += block->used - start;
+    list->lastPosition = position;
+    list->count++;
+}
+
+// freePostings - Releases a posting list (NULL is fine)
+void freePostings(POSTING_LIST *postings) {
+    if (postings == NULL) {
+        return;
+    }
+    POSTING_BLOCK *block = postings->first->next;   // The first block is part of the list
+    while (block != NULL) {
+        POSTING_BLOCK *next = block->next;
+        trackedFree(block, sizeof(POSTING_BLOCK) + (size_t)block->capacity, MEM_NODES);
+        block = next;
+    }
+    trackedFree(postings, sizeof(POSTING_LIST) + sizeof(POSTING_BLOCK) + POSTING_BLOCK_START,
+                MEM_NODES);
+}
+
+// writeLittleEndian - Writes the low bytes of value, least significant first
+void writeLittleEndian(FILE *fp, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc((int)((value >> (8 * i)) & 0xFF), fp);
+    }
+}
+
+// writePositionIndex - Writes the --positions index file
+// Layout (all integers little-endian):
+//   Header (48 bytes): magic "MADPOS01", u32 version, u32 reserved,
+//     u64 word count, u64 directory offset, u64 strings offset,
+//     u64 postings offset
+//   Directory (32 bytes per word, in the same ASCII order as -w):
+//     u64 string offset, u32 word length, u32 occurrence count,
+//     u64 postings offset, u64 postings length
+//     (string and postings offsets are relative to their section)
+//   Strings: the words, back to back, not NUL-terminated
+//   Postings: each word's varint gap list, back to back
+// A reader can binary-search the fixed-size directory for one word and
+// decode just that word's postings. Unless the list is already alphabetical
+// (it isn't with --sort), it is put in ASCII order here for the directory.
+// Returns: 1 on success, 0 if the file can't be written
+int writePositionIndex(const char *filename, WORD *wordHead, int uniqueWords, int alphabetical) {
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    WORD **nodes = (WORD **)trackedMalloc(sizeof(WORD *) * (size_t)(uniqueWords + 1), MEM_SORT);
+    if (nodes == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+    int count = 0;
+    uint64_t stringBytes = 0;
+    for (WORD *current = wordHead; current != NULL; current = current->nextWord) {
+        nodes[count++] = current;
+        stringBytes += (uint64_t)current->numChars;
+    }
+    if (!alphabetical) {
+        qsort(nodes, (size_t)count, sizeof(WORD *), compareWordNodes);
+    }
+    uint64_t directoryOffset = POSITION_HEADER_SIZE;
+    uint64_t stringsOffset = directoryOffset + (uint64_t)uniqueWords * POSITION_ENTRY_SIZE;
+    uint64_t postingsOffset = stringsOffset + stringBytes;
+
+    fwrite(POSITION_INDEX_MAGIC, 1, 8, fp);
+    writeLittleEndian(fp, POSITION_INDEX_VERSION, 4);
+    writeLittleEndian(fp, 0, 4);
+    writeLittleEndian(fp, (uint64_t)uniqueWords, 8);
+    writeLittleEndian(fp, directoryOffset, 8);
+    writeLittleEndian(fp, stringsOffset, 8);
+    writeLittleEndian(fp, postingsOffset, 8);
+
+    uint64_t stringAt = 0;
+    uint64_t postingAt = 0;
+    for (int i = 0; i < count; i++) {
+        WORD *current = nodes[i];
+        writeLittleEndian(fp, stringAt, 8);
+        writeLittleEndian(fp, (uint64_t)current->numChars, 4);
+        writeLittleEndian(fp, (uint64_t)current->postings->count, 4);
+        writeLittleEndian(fp, postingAt, 8);
+        writeLittleEndian(fp, (uint64_t)current->postings->totalBytes, 8);
+        stringAt += (uint64_t)current->numChars;
+        postingAt += (uint64_t)current->postings->totalBytes;
+    }
+
+    for (int i = 0; i < count; i++) {
+        fwrite(nodes[i]->contents, 1, (size_t)nodes[i]->numChars, fp);
+    }
+
+    for (int i = 0; i < count; i++) {
+        for (POSTING_BLOCK *block = nodes[i]->postings->first; block != NULL; block = block->next) {
+            fwrite(block->data, 1, (size_t)block->used, fp);
+        }
+    }
+
+    trackedFree(nodes, sizeof(WORD *) * (size_t)(uniqueWords + 1), MEM_SORT);
+    int ok = !ferror(fp);
+    if (fclose(fp) != 0) {
+        ok = 0;
+    }
+    return ok;
 }
 
 // =============================================================================
@@ -364,36 +1702,58 @@ void freeWordList(WORD *head) {
 // =============================================================================
 // Parameters:
 //   argc, argv: Command-line arguments from main()
-//   inputFile: Pointer to store input filename (set by -f flag)
-//   outputFile: Pointer to store output filename (set by -o flag, can be NULL)
-//   requestCharAnalysis: Set to 1 if -c flag is present
-//   requestWordAnalysis: Set to 1 if -w flag is present
-//   requestLineAnalysis: Set to 1 if -l flag is present
-//   requestLongestWord: Set to 1 if -Lw flag is present
-//   requestLongestLine: Set to 1 if -Ll flag is present
+//   options: Filled in with everything the command asked for:
+//     inputFile: Input filename (set by -f flag)
+//     outputFile: Output filename (set by -o flag, can be NULL)
+//     requestCharAnalysis: Set to 1 if -c flag is present
+//     requestWordAnalysis: Set to 1 if -w flag is present
+//     requestLineAnalysis: Set to 1 if -l flag is present
+//     requestLongestWord: Set to 1 if -Lw flag is present
+//     requestLongestLine: Set to 1 if -Ll flag is present
+//     requestPairAnalysis: Set to 1 if -c2 flag is present
+//     pairTopCount: Set by --top <n> (0 if absent)
+//     requestWordHistogram: Set to 1 if -hw flag is present
+//     requestLineHistogram: Set to 1 if -hl flag is present
+//     requestCodePointAnalysis: Set to 1 if -cu flag is present
+//     ignoreCase: Set to 1 if -i flag is present
+//     printLowercase: Set by --case-print first|lower (0 = first-seen form)
+//     extraDelims: Set by --delims <chars> (NULL if absent)
+//     stripPunct: Set to 1 if --strip-punct flag is present
+//     matchPatterns, matchCount: Every --match <substring>, in order
+//     matchAny: Set to 1 if --match-any flag is present
+//     matchChars: Set to 1 if --match-chars flag is present
+//     regexPattern: Set by --regex <pattern> (NULL if absent)
+//     stopwordFile: Set by --stopwords <file> (NULL if absent)
+//     countStopwords: Set to 1 if --count-stopwords flag is present
+//     timeFormat, bucketWidth: Set by --time-buckets <format,width> (0 if absent)
+//     inputFile, diffFile: Set by --diff <a> <b> (diffFile NULL if absent)
+//     positionsFile: Set by --positions <indexfile> (NULL if absent)
+//     column: Set by --column <n> (0 if absent)
+//     separator: Set by --sep <c> (',' if absent)
+//     presorted: Set to 1 if --presorted flag is present
+//     sortOrder, sortDescending: Set by --sort <order>[-desc] (SORT_ALPHA, 0 if absent),
+//                                or to SORT_NONE by --order first-seen
+//     diffRank: Set by --diff-rank abs|rel (DIFF_RANK_ALPHA if absent)
+//     format: Set by --format json|jsonl|csv|tsv|bin|arrow (FORMAT_TEXT if absent)
+//     dumpFile: Set by --dump <file> (NULL if absent)
+//     compress: Set by --compress gzip|zstd (COMPRESS_NONE if absent)
+//     stats: Set to 1 if --stats flag is present
+//     perfCounters: Set to 1 if --perf-counters flag is present
+//     allocStats: Set to 1 if --alloc-stats flag is present
+//     targetFormats, targetFiles, targetCount: Every -o fmt:path, in order
+//                                              (a plain -o joins them as --format)
 //
 // Return: 1 if all arguments are valid, 0 if error (error message already printed)
 // =============================================================================
-int parseArguments(int argc, char *argv[],
-                   char **inputFile,
-                   char **outputFile,
-                   int *requestCharAnalysis,
-                   int *requestWordAnalysis,
-                   int *requestLineAnalysis,
-                   int *requestLongestWord,
-                   int *requestLongestLine,
-                   int flagOrder[],
-                   int *flagCount) {
+int parseArguments(int argc, char *argv[], OPTIONS *options) {
 
     // Initialize all output parameters to their default values
-    *inputFile = NULL;
-    *outputFile = NULL;
-    *requestCharAnalysis = 0;
-    *requestWordAnalysis = 0;
-    *requestLineAnalysis = 0;
-    *requestLongestWord = 0;
-    *requestLongestLine = 0;
-    *flagCount = 0;
+    memset(options, 0, sizeof(OPTIONS));
+    options->separator = ',';
+
+    // Flags other than -o and --dump seen (--dump allows none of them)
+    int analysisOptionCount = 0;
+    int casePrintGiven = 0;     // --case-print (it needs -i)
 
     // Loop through all arguments starting at index 1 (skip program name at argv[0])
     for (int i = 1; i < argc; i++) {
@@ -401,6 +1761,9 @@ int parseArguments(int argc, char *argv[],
 
         // Check if this argument starts with "-" (it's a flag)
         if (arg[0] == '-') {
+            if (strcmp(arg, "-o") != 0 && strcmp(arg, "--dump") != 0) {
+                analysisOptionCount++;
+            }
 
             // Handle -f flag (input file)
             if (strcmp(arg, "-f") == 0) {
@@ -424,7 +1787,7 @@ int parseArguments(int argc, char *argv[],
                 }
 
                 // Valid: store the filename and skip the next argument
-                *inputFile = nextArg;
+                options->inputFile = nextArg;
                 i++;  // Skip the filename we just processed
             }
 
@@ -448,370 +1811,4716 @@ int parseArguments(int argc, char *argv[],
                     return 0;
                 }
 
+                // -o fmt:path adds one of several outputs; anything else
+                // (including a path with a colon in it) is the one -o file
+                char *colon = strchr(nextArg, ':');
+                int targetFormat = -1;
+                if (colon != NULL && colon[1] != '\0') {
+                    *colon = '\0';
+                    targetFormat = parseFormatName(nextArg);
+                    *colon = ':';
+                }
+                if (targetFormat >= 0) {
+                    if (options->targetCount == MAX_OUTPUT_TARGETS) {
+                        printTooManyOutputsError();
+                        return 0;
+                    }
+                    options->targetFormats[options->targetCount] = targetFormat;
+                    options->targetFiles[options->targetCount] = colon + 1;
+                    options->targetCount++;
+                    i++;  // Skip the target we just processed
+                    continue;
+                }
+
                 // Valid: store the filename and skip the next argument
-                *outputFile = nextArg;
+                options->outputFile = nextArg;
                 i++;  // Skip the filename we just processed
             }
 
             // Handle -c flag (character analysis)
             else if (strcmp(arg, "-c") == 0) {
                 // No parameter needed - just set the flag
-                if (!*requestCharAnalysis) {
-                    flagOrder[(*flagCount)++] = FLAG_C;
+                if (!options->requestCharAnalysis) {
+                    options->flagOrder[options->flagCount++] = FLAG_C;
                 }
-                *requestCharAnalysis = 1;
+                options->requestCharAnalysis = 1;
             }
 
             // Handle -w flag (word analysis)
             else if (strcmp(arg, "-w") == 0) {
                 // No parameter needed - just set the flag
-                if (!*requestWordAnalysis) {
-                    flagOrder[(*flagCount)++] = FLAG_W;
+                if (!options->requestWordAnalysis) {
+                    options->flagOrder[options->flagCount++] = FLAG_W;
                 }
-                *requestWordAnalysis = 1;
+                options->requestWordAnalysis = 1;
             }
 
             // Handle -l flag (line analysis)
             else if (strcmp(arg, "-l") == 0) {
                 // No parameter needed - just set the flag
-                if (!*requestLineAnalysis) {
-                    flagOrder[(*flagCount)++] = FLAG_L;
+                if (!options->requestLineAnalysis) {
+                    options->flagOrder[options->flagCount++] = FLAG_L;
                 }
-                *requestLineAnalysis = 1;
+                options->requestLineAnalysis = 1;
             }
 
             // Handle -Lw flag (longest word)
             else if (strcmp(arg, "-Lw") == 0) {
                 // No parameter needed - just set the flag
-                if (!*requestLongestWord) {
-                    flagOrder[(*flagCount)++] = FLAG_LW;
+                if (!options->requestLongestWord) {
+                    options->flagOrder[options->flagCount++] = FLAG_LW;
                 }
-                *requestLongestWord = 1;
+                options->requestLongestWord = 1;
             }
 
             // Handle -Ll flag (longest line)
             else if (strcmp(arg, "-Ll") == 0) {
                 // No parameter needed - just set the flag
-                if (!*requestLongestLine) {
-                    flagOrder[(*flagCount)++] = FLAG_LL;
+                if (!options->requestLongestLine) {
+                    options->flagOrder[options->flagCount++] = FLAG_LL;
                 }
-                *requestLongestLine = 1;
+                options->requestLongestLine = 1;
             }
 
-            // Unknown flag - not one of our valid flags
-            else {
-                // This is a flag (starts with -) but it's not recognized
-                printInvalidFlagError();
-                return 0;
+            // Handle -c2 flag (byte-pair analysis)
+            else if (strcmp(arg, "-c2") == 0) {
+                // No parameter needed - just set the flag
+                if (!options->requestPairAnalysis) {
+                    options->flagOrder[options->flagCount++] = FLAG_C2;
+                }
+                options->requestPairAnalysis = 1;
             }
-        }
-        // If argument doesn't start with "-", it's invalid
-        // (all arguments except filenames for -f and -o should be flags)
-        else {
-            // This argument doesn't start with "-" and isn't a filename following -f or -o
-            // (if it were, it would have been processed above)
-            printInvalidFlagError();
-            return 0;
-        }
-    }
 
-    // After processing all arguments, validate that required flags are present
-    // The -f flag (input file) is REQUIRED
-    if (*inputFile == NULL) {
-        // No input file was specified with -f flag
-        printNoInputFileError();
-        return 0;
+            // Handle -cu flag (UTF-8 code point analysis)
+            else if (strcmp(arg, "-cu") == 0) {
+                // No parameter needed - just set the flag
+                if (!options->requestCodePointAnalysis) {
+                    options->flagOrder[options->flagCount++] = FLAG_CU;
+                }
+                options->requestCodePointAnalysis = 1;
+            }
+
+            // Handle -hw flag (word length histogram)
+            else if (strcmp(arg, "-hw") == 0) {
+                // No parameter needed - just set the flag
+                if (!options->requestWordHistogram) {
+                    options->flagOrder[options->flagCount++] = FLAG_HW;
+                }
+                options->requestWordHistogram = 1;
+            }
+
+            // Handle -hl flag (line length histogram)
+            else if (strcmp(arg, "-hl") == 0) {
+                // No parameter needed - just set the flag
+                if (!options->requestLineHistogram) {
+                    options->flagOrder[options->flagCount++] = FLAG_HL;
+                }
+                options->requestLineHistogram = 1;
+            }
+
+            // Handle -i flag (case-insensitive words and lines)
+            else if (strcmp(arg, "-i") == 0) {
+                options->ignoreCase = 1;
+            }
+
+            // Handle --case-print flag (how -i prints merged entries)
+            else if (strcmp(arg, "--case-print") == 0) {
+                // --case-print needs a parameter: "first" or "lower"
+                if (i + 1 >= argc) {
+                    printInvalidCasePrintError();
+                    return 0;
+                }
+
+                char *nextArg = argv[i + 1];
+                if (strcmp(nextArg, "first") == 0) {
+                    options->printLowercase = 0;
+                } else if (strcmp(nextArg, "lower") == 0) {
+                    options->printLowercase = 1;
+                } else {
+                    printInvalidCasePrintError();
+                    return 0;
+                }
+                casePrintGiven = 1;
+                i++;  // Skip the mode we just processed
+            }
+
+            // Handle --delims flag (extra word separator characters)
+            else if (strcmp(arg, "--delims") == 0) {
+                // --delims needs a parameter: the characters themselves.
+                // It may start with "-" since "-" is a perfectly good delimiter.
+                if (i + 1 >= argc || argv[i + 1][0] == '\0') {
+                    printNoDelimitersError();
+                    return 0;
+                }
+                options->extraDelims = argv[i + 1];
+                i++;  // Skip the characters we just processed
+            }
+
+            // Handle --strip-punct flag (trim punctuation off words)
+            else if (strcmp(arg, "--strip-punct") == 0) {
+                options->stripPunct = 1;
+            }
+
+            // Handle --match flag (only analyze lines containing a substring)
+            else if (strcmp(arg, "--match") == 0) {
+                // --match needs a parameter: the substring
+                if (i + 1 >= argc || argv[i + 1][0] == '\0') {
+                    printNoMatchPatternError();
+                    return 0;
+                }
+                if (options->matchCount >= MAX_MATCH_PATTERNS) {
+                    printTooManyMatchPatternsError();
+                    return 0;
+                }
+                options->matchPatterns[options->matchCount++] = argv[i + 1];
+                i++;  // Skip the substring we just processed
+            }
+
+            // Handle --regex flag (only analyze lines matching a pattern)
+            else if (strcmp(arg, "--regex") == 0) {
+                // --regex needs a parameter: the pattern
+                if (i + 1 >= argc || argv[i + 1][0] == '\0') {
+                    printNoRegexError();
+                    return 0;
+                }
+                options->regexPattern = argv[i + 1];
+                i++;  // Skip the pattern we just processed
+            }
+
+            // Handle --stopwords flag (words to leave out of word analysis)
+            else if (strcmp(arg, "--stopwords") == 0) {
+                // --stopwords needs a parameter: the stopword file
+                if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                    printNoStopwordFileError();
+                    return 0;
+                }
+                options->stopwordFile = argv[i + 1];
+                i++;  // Skip the filename we just processed
+            }
+
+            // Handle --count-stopwords flag (stopwords still count in totals)
+            else if (strcmp(arg, "--count-stopwords") == 0) {
+                options->countStopwords = 1;
+            }
+
+            // Handle --time-buckets flag (per-interval reports for timestamped logs)
+            else if (strcmp(arg, "--time-buckets") == 0) {
+                // --time-buckets needs a parameter: "<format>,<width>"
+                if (i + 1 >= argc ||
+                    !parseTimeBucketSpec(argv[i + 1], &options->timeFormat,
+                                         &options->bucketWidth)) {
+                    printInvalidTimeBucketsError();
+                    return 0;
+                }
+                i++;  // Skip the spec we just processed
+            }
+
+            // Handle --diff flag (compare two files instead of analyzing one)
+            else if (strcmp(arg, "--diff") == 0) {
+                // --diff needs two parameters: the first and second file.
+                // The first one takes the place of -f.
+                if (i + 2 >= argc || argv[i + 1][0] == '-' || argv[i + 2][0] == '-') {
+                    printNoDiffFilesError();
+                    return 0;
+                }
+                options->inputFile = argv[i + 1];
+                options->diffFile = argv[i + 2];
+                i += 2;  // Skip the two filenames we just processed
+            }
+
+            // Handle --positions flag (write every word position to an index file)
+            else if (strcmp(arg, "--positions") == 0) {
+                // --positions needs a parameter: the index filename
+                if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                    printNoPositionsFileError();
+                    return 0;
+                }
+                options->positionsFile = argv[i + 1];
+                i++;  // Skip the filename we just processed
+            }
+
+            // Handle --column flag (count one delimited field instead of words)
+            else if (strcmp(arg, "--column") == 0) {
+                // --column needs a parameter: a field number, counting from 1
+                if (i + 1 >= argc) {
+                    printInvalidColumnError();
+                    return 0;
+                }
+
+                char *nextArg = argv[i + 1];
+                char *end = NULL;
+                long value = strtol(nextArg, &end, 10);
+                if (end == nextArg || *end != '\0' || value <= 0 || value > 1000000) {
+                    printInvalidColumnError();
+                    return 0;
+                }
+
+                options->column = (int)value;
+                i++;  // Skip the number we just processed
+            }
+
+            // Handle --sep flag (field separator for --column)
+            else if (strcmp(arg, "--sep") == 0) {
+                // --sep needs a parameter: one character, or \t for a tab.
+                // It may be "-" since that is a perfectly good separator.
+                if (i + 1 >= argc) {
+                    printInvalidSeparatorError();
+                    return 0;
+                }
+
+                char *nextArg = argv[i + 1];
+                if (strcmp(nextArg, "\\t") == 0) {
+                    options->separator = '\t';
+                } else if (nextArg[0] != '\0' && nextArg[1] == '\0' &&
+                           nextArg[0] != '"' && nextArg[0] != '\n') {
+                    options->separator = nextArg[0];
+                } else {
+                    printInvalidSeparatorError();
+                    return 0;
+                }
+                i++;  // Skip the separator we just processed
+            }
+
+            // Handle --sort flag (order of the -w/-l listings)
+            else if (strcmp(arg, "--sort") == 0) {
+                // --sort needs a parameter: alpha, freq, first or len,
+                // optionally with "-desc" appended
+                if (i + 1 >= argc) {
+                    printInvalidSortOrderError();
+                    return 0;
+                }
+
+                char *nextArg = argv[i + 1];
+                size_t nameLength = strlen(nextArg);
+                options->sortDescending = 0;
+                if (nameLength > 5 && strcmp(nextArg + nameLength - 5, "-desc") == 0) {
+                    options->sortDescending = 1;
+                    nameLength -= 5;
+                }
+
+                if (nameLength == 5 && strncmp(nextArg, "alpha", 5) == 0) {
+                    options->sortOrder = SORT_ALPHA;
+                } else if (nameLength == 4 && strncmp(nextArg, "freq", 4) == 0) {
+                    options->sortOrder = SORT_FREQ;
+                } else if (nameLength == 5 && strncmp(nextArg, "first", 5) == 0) {
+                    options->sortOrder = SORT_FIRST;
+                } else if (nameLength == 3 && strncmp(nextArg, "len", 3) == 0) {
+                    options->sortOrder = SORT_LEN;
+                } else {
+                    printInvalidSortOrderError();
+                    return 0;
+                }
+                i++;  // Skip the order we just processed
+            }
+
+            // Handle --order flag (first-seen: skip sorting the listings)
+            else if (strcmp(arg, "--order") == 0) {
+                if (i + 1 >= argc || strcmp(argv[i + 1], "first-seen") != 0) {
+                    printInvalidOrderError();
+                    return 0;
+                }
+                options->sortOrder = SORT_NONE;
+                options->sortDescending = 0;
+                i++;  // Skip the order we just processed
+            }
+
+            // Handle --format flag (structured output instead of the text report)
+            else if (strcmp(arg, "--format") == 0) {
+                if (i + 1 >= argc) {
+                    printInvalidFormatError();
+                    return 0;
+                }
+
+                options->format = parseFormatName(argv[i + 1]);
+                if (options->format < 0) {
+                    printInvalidFormatError();
+                    return 0;
+                }
+                i++;  // Skip the format we just processed
+            }
+
+            // Handle --dump flag (print a --format bin file as text)
+            else if (strcmp(arg, "--dump") == 0) {
+                if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                    printNoDumpFileError();
+                    return 0;
+                }
+                options->dumpFile = argv[i + 1];
+                i++;  // Skip the filename we just processed
+            }
+
+            // Handle --compress flag (compress the -o file as it is written)
+            else if (strcmp(arg, "--compress") == 0) {
+                if (i + 1 >= argc) {
+                    printInvalidCompressError();
+                    return 0;
+                }
+
+                char *nextArg = argv[i + 1];
+                if (strcmp(nextArg, "gzip") == 0) {
+                    options->compress = COMPRESS_GZIP;
+                } else if (strcmp(nextArg, "zstd") == 0) {
+                    options->compress = COMPRESS_ZSTD;
+                } else {
+                    printInvalidCompressError();
+                    return 0;
+                }
+                i++;  // Skip the compressor we just processed
+            }
+
+            // Handle --stats flag (phase times and sizes on stderr)
+            else if (strcmp(arg, "--stats") == 0) {
+                options->stats = 1;
+            }
+
+            // Handle --perf-counters flag (hardware counters per phase on stderr)
+            else if (strcmp(arg, "--perf-counters") == 0) {
+                options->perfCounters = 1;
+            }
+
+            // Handle --alloc-stats flag (memory use by category on stderr)
+            else if (strcmp(arg, "--alloc-stats") == 0) {
+                options->allocStats = 1;
+            }
+
+            // Handle --presorted flag (input lines are already sorted)
+            else if (strcmp(arg, "--presorted") == 0) {
+                options->presorted = 1;
+            }
+
+            // Handle --diff-rank flag (how --diff orders its listing)
+            else if (strcmp(arg, "--diff-rank") == 0) {
+                // --diff-rank needs a parameter: "abs" or "rel"
+                if (i + 1 >= argc) {
+                    printInvalidDiffRankError();
+                    return 0;
+                }
+
+                char *nextArg = argv[i + 1];
+                if (strcmp(nextArg, "abs") == 0) {
+                    options->diffRank = DIFF_RANK_ABS;
+                } else if (strcmp(nextArg, "rel") == 0) {
+                    options->diffRank = DIFF_RANK_REL;
+                } else {
+                    printInvalidDiffRankError();
+                    return 0;
+                }
+                i++;  // Skip the mode we just processed
+            }
+
+            // Handle --match-any flag (a line needs any pattern, not all)
+            else if (strcmp(arg, "--match-any") == 0) {
+                options->matchAny = 1;
+            }
+
+            // Handle --match-chars flag (character analyses use matching lines only)
+            else if (strcmp(arg, "--match-chars") == 0) {
+                options->matchChars = 1;
+            }
+
+            // Handle --top flag (limit -c2 output to the n most frequent pairs)
+            else if (strcmp(arg, "--top") == 0) {
+                // --top needs a parameter: a positive count
+                if (i + 1 >= argc) {
+                    printInvalidTopCountError();
+                    return 0;
+                }
+
+                char *nextArg = argv[i + 1];
+                char *end = NULL;
+                long value = strtol(nextArg, &end, 10);
+                if (end == nextArg || *end != '\0' || value <= 0 || value > PAIR_RANGE) {
+                    printInvalidTopCountError();
+                    return 0;
+                }
+
+                options->pairTopCount = (int)value;
+                i++;  // Skip the count we just processed
+            }
+
+            // Unknown flag - not one of our valid flags
+            else {
+                // This is a flag (starts with -) but it's not recognized
+                printInvalidFlagError();
+                return 0;
+            }
+        }
+        // If argument doesn't start with "-", it's invalid
+        // (all arguments except filenames for -f and -o should be flags)
+        else {
+            // This argument doesn't start with "-" and isn't a filename following -f or -o
+            // (if it were, it would have been processed above)
+            printInvalidFlagError();
+            return 0;
+        }
+    }
+
+    // With -o fmt:path outputs, a plain -o file is one more of them
+    if (options->targetCount > 0 && options->outputFile != NULL) {
+        if (options->targetCount == MAX_OUTPUT_TARGETS) {
+            printTooManyOutputsError();
+            return 0;
+        }
+        options->targetFormats[options->targetCount] = options->format;
+        options->targetFiles[options->targetCount] = options->outputFile;
+        options->targetCount++;
+        options->outputFile = NULL;
+    }
+
+    // No two outputs may share a file, and none may overwrite a file being read
+    if (!checkOutputPaths(options)) {
+        printDuplicateOutputError();
+        return 0;
+    }
+
+    // --compress applies to the -o files
+    if (options->compress != COMPRESS_NONE && options->outputFile == NULL &&
+        options->targetCount == 0) {
+        printCompressNeedsOutputError();
+        return 0;
+    }
+
+    // --case-print only says how -i prints the entries it merged
+    if (casePrintGiven && !options->ignoreCase) {
+        printCasePrintNeedsIgnoreCaseError();
+        return 0;
+    }
+
+    // --top only limits the -c2 listing
+    if (options->pairTopCount > 0 && !options->requestPairAnalysis) {
+        printTopNeedsPairsError();
+        return 0;
+    }
+
+    // --dump reads a result file instead of analyzing one; only -o goes with it
+    if (options->dumpFile != NULL) {
+        if (analysisOptionCount > 0 || options->targetCount > 0) {
+            printInvalidDumpOptionsError();
+            return 0;
+        }
+        return 1;
+    }
+
+    // After processing all arguments, validate that required flags are present
+    // The -f flag (input file) is REQUIRED
+    if (options->inputFile == NULL) {
+        // No input file was specified with -f flag
+        printNoInputFileError();
+        return 0;
+    }
+
+    // --diff only compares word and line counts
+    if (options->diffFile != NULL) {
+        for (int i = 0; i < options->flagCount; i++) {
+            if (options->flagOrder[i] != FLAG_W && options->flagOrder[i] != FLAG_L) {
+                printInvalidDiffOptionsError();
+                return 0;
+            }
+        }
+        if (options->timeFormat != 0) {
+            printInvalidDiffOptionsError();
+            return 0;
+        }
+    }
+
+    // --positions indexes the whole file's word list
+    if (options->positionsFile != NULL &&
+        (options->diffFile != NULL || options->timeFormat != 0)) {
+        printInvalidPositionsOptionsError();
+        return 0;
+    }
+
+    // --format covers the character, word and line sections
+    if (usesStructuredOutput(options)) {
+        for (int i = 0; i < options->flagCount; i++) {
+            if (options->flagOrder[i] > FLAG_LL) {
+                printInvalidFormatOptionsError();
+                return 0;
+            }
+        }
+        if (options->diffFile != NULL || options->timeFormat != 0) {
+            printInvalidFormatOptionsError();
+            return 0;
+        }
+    }
+
+    // All arguments are valid!
+    return 1;
+}
+
+// parseFormatName - Looks up a --format (or -o fmt:path) name
+// Returns: FORMAT_*, or -1 if the name isn't a format
+int parseFormatName(const char *name) {
+    if (strcmp(name, "text") == 0) {
+        return FORMAT_TEXT;
+    } else if (strcmp(name, "json") == 0) {
+        return FORMAT_JSON;
+    } else if (strcmp(name, "jsonl") == 0) {
+        return FORMAT_JSONL;
+    } else if (strcmp(name, "csv") == 0) {
+        return FORMAT_CSV;
+    } else if (strcmp(name, "tsv") == 0) {
+        return FORMAT_TSV;
+    } else if (strcmp(name, "bin") == 0) {
+        return FORMAT_BIN;
+    } else if (strcmp(name, "arrow") == 0) {
+        return FORMAT_ARROW;
+    }
+    return -1;
+}
+
+// usesStructuredOutput - Checks whether any report of the command is in a
+// --format other than text (those need the word and line lists built)
+int usesStructuredOutput(OPTIONS *options) {
+    if (options->targetCount == 0) {
+        return options->format != FORMAT_TEXT;
+    }
+    for (int i = 0; i < options->targetCount; i++) {
+        if (options->targetFormats[i] != FORMAT_TEXT) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// samePath - Checks whether two paths name the same file: the same string,
+// or (for files that already exist) the same inode
+int samePath(const char *first, const char *second) {
+    if (strcmp(first, second) == 0) {
+        return 1;
+    }
+    struct stat firstInfo, secondInfo;
+    if (stat(first, &firstInfo) != 0 || stat(second, &secondInfo) != 0) {
+        return 0;
+    }
+    return firstInfo.st_dev == secondInfo.st_dev && firstInfo.st_ino == secondInfo.st_ino;
+}
+
+// checkOutputPaths - Checks that the files a command writes (the -o files
+// and the --positions index) are all different, and that none of them is
+// the -f, --diff or --dump file it reads
+// Returns: 1 if they are, 0 if two of them are the same file
+int checkOutputPaths(OPTIONS *options) {
+    const char *written[MAX_OUTPUT_TARGETS + 2];
+    const char *read[] = {options->inputFile, options->diffFile, options->dumpFile};
+    int writtenCount = 0;
+
+    for (int i = 0; i < options->targetCount; i++) {
+        written[writtenCount++] = options->targetFiles[i];
+    }
+    if (options->outputFile != NULL) {
+        written[writtenCount++] = options->outputFile;
+    }
+    if (options->positionsFile != NULL) {
+        written[writtenCount++] = options->positionsFile;
+    }
+
+    for (int i = 0; i < writtenCount; i++) {
+        for (int j = i + 1; j < writtenCount; j++) {
+            if (samePath(written[i], written[j])) {
+                return 0;
+            }
+        }
+        for (int j = 0; j < (int)(sizeof(read) / sizeof(read[0])); j++) {
+            if (read[j] != NULL && samePath(written[i], read[j])) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// =============================================================================
+// LINE ANALYSIS FUNCTIONS
+// =============================================================================
+
+// insertLine - Counts one occurrence of a line in a line table
+// Lines live in their own table but are counted exactly like words
+void insertLine(WORD_TABLE *table, const char *line, int length, int position) {
+    insertWord(table, line, length, position);
+}
+
+// printLineAnalysis - Prints line statistics
+void printLineAnalysis(FILE *outputFile, WORD *lineHead, int totalLines, int uniqueLines) {
+    fprintf(outputFile, "Total Number of Lines: %d\n", totalLines);
+    fprintf(outputFile, "Total Unique Lines: %d\n\n", uniqueLines);
+
+    // List is already sorted alphabetically
+    WORD *current = lineHead;
+    while (current != NULL) {
+        printToken(outputFile, "Line: ", current->contents, current->numChars);
+        fprintf(outputFile, ", Freq: %d, Initial Position: %d\n",
+               current->frequency, current->orderAppeared);
+        current = current->nextWord;
+    }
+}
+
+// freeLineList - Deallocates all nodes in the line list
+void freeLineList(WORD *head) {
+    WORD *current = head;
+    while (current != NULL) {
+        WORD *temp = current;
+        current = current->nextWord;
+        trackedFree(temp->contents, (size_t)temp->numChars + 1, MEM_STRINGS);
+        trackedFree(temp, sizeof(WORD), MEM_NODES);
+    }
+}
+
+// =============================================================================
+// TEXT SCAN FUNCTIONS
+// =============================================================================
+
+// buildCharClassTable - Compiles the tokenizer options into a lookup table
+// The word tokenizer only ever asks "what class is this byte?", so custom
+// delimiters and punctuation stripping cost one table load per byte, the
+// same as plain whitespace splitting.
+// Parameters:
+//   charClass: BYTE_RANGE entries to fill with CLASS_* bits
+//   extraDelims: Extra separator characters from --delims (NULL for none).
+//                "\t", "\\" and "\s" (space) escapes are understood.
+//   stripPunct: 1 to mark ASCII punctuation as CLASS_PUNCT
+void buildCharClassTable(unsigned char charClass[], const char *extraDelims, int stripPunct) {
+    memset(charClass, 0, BYTE_RANGE);
+
+    // The characters fscanf("%s") stops at
+    charClass[' '] = CLASS_SEPARATOR;
+    charClass['\t'] = CLASS_SEPARATOR;
+    charClass['\n'] = CLASS_SEPARATOR;
+    charClass['\v'] = CLASS_SEPARATOR;
+    charClass['\f'] = CLASS_SEPARATOR;
+    charClass['\r'] = CLASS_SEPARATOR;
+
+    if (extraDelims != NULL) {
+        for (const char *p = extraDelims; *p != '\0'; p++) {
+            unsigned char c = (unsigned char)*p;
+            if (c == '\\' && p[1] != '\0') {
+                p++;
+                if (*p == 't') {
+                    c = '\t';
+                } else if (*p == 's') {
+                    c = ' ';
+                } else {
+                    c = (unsigned char)*p;
+                }
+            }
+            charClass[c] |= CLASS_SEPARATOR;
+        }
+    }
+
+    if (stripPunct) {
+        // ASCII punctuation: everything printable that is not a letter or digit
+        for (int c = '!'; c <= '~'; c++) {
+            int isLetter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            int isDigit = (c >= '0' && c <= '9');
+            if (!isLetter && !isDigit) {
+                charClass[c] |= CLASS_PUNCT;
+            }
+        }
+    }
+}
+
+// addToHistogram - Counts one word/line of the given length
+void addToHistogram(LENGTH_HISTOGRAM *histogram, long length) {
+    if (length < HISTOGRAM_EXACT_LENGTHS) {
+        histogram->exact[length]++;
+    } else {
+        // Find k such that 2^k <= length < 2^(k+1)
+        int bucket = 0;
+        while ((length >> (bucket + 1)) != 0) {
+            bucket++;
+        }
+        histogram->logBuckets[bucket]++;
+    }
+    if (length > histogram->maxLength) {
+        histogram->maxLength = length;
+    }
+    histogram->total++;
+}
+
+// countWordToken - Counts one word from the tokenizer (or one --column value)
+// Stopwords are never inserted, and unless countStopwords is set they are
+// not counted at all
+// Returns: 1 if the word took a word position, 0 if it was dropped
+int countWordToken(TEXT_SCAN *scan, WORD_TABLE *wordTable, const char *word,
+                   long length, int position) {
+    int stopword = scan->stopwords != NULL && length > 0 &&
+                   isStopword(scan->stopwords, word, (int)length);
+    if (stopword && !scan->countStopwords) {
+        return 0;
+    }
+
+    scan->totalWords++;
+    if (scan->wordLengths != NULL) {
+        addToHistogram(scan->wordLengths, length);
+    }
+    if (scan->buildWordList && !stopword) {
+        insertWord(wordTable, word, (int)length, position);
+    }
+    return 1;
+}
+
+// findField - Finds field number column (1-based) in one delimited line
+// Fields are split on separator. A field that starts with a double quote
+// runs to its closing quote, so separators inside it don't split it, and ""
+// inside it stands for one quote (CSV quoting). Field boundaries are found
+// with memchr(), which the C library vectorizes. A trailing '\r' (CRLF
+// files) is not part of the last field, and blank lines have no fields.
+// Returns: 1 if the line has that many fields, with *field/*fieldLength set
+//          to the value (unquoted; rewritten into *buffer if it had ""), or 0
+int findField(const char *line, long length, int column, char separator,
+              char **buffer, long *bufferSize, const char **field, long *fieldLength) {
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    long pos = 0;
+    for (int current = 1; ; current++) {
+        long start = pos;
+        long end;
+        int doubledQuotes = 0;
+
+        if (pos < length && line[pos] == '"') {
+            // Quoted field: find the closing quote, stepping over "" pairs
+            long quote = pos + 1;
+            while (quote < length) {
+                const char *found = (const char *)memchr(line + quote, '"', (size_t)(length - quote));
+                if (found == NULL) {
+                    quote = length;   // Unterminated: the rest of the line
+                    break;
+                }
+                quote = (long)(found - line);
+                if (quote + 1 < length && line[quote + 1] == '"') {
+                    doubledQuotes = 1;
+                    quote += 2;
+                    continue;
+                }
+                break;
+            }
+            start = pos + 1;
+            end = (quote < length) ? quote : length;
+
+            // Anything between the closing quote and the separator is ignored
+            pos = (quote < length) ? quote + 1 : length;
+            const char *next = (const char *)memchr(line + pos, separator, (size_t)(length - pos));
+            pos = (next != NULL) ? (long)(next - line) : length;
+        } else {
+            const char *next = (const char *)memchr(line + pos, separator, (size_t)(length - pos));
+            end = (next != NULL) ? (long)(next - line) : length;
+            pos = end;
+        }
+
+        if (current == column) {
+            if (!doubledQuotes) {
+                *field = line + start;
+                *fieldLength = end - start;
+                return 1;
+            }
+
+            // Collapse each "" to a single quote
+            if (*bufferSize < end - start) {
+                *buffer = (char *)trackedRealloc(*buffer, (size_t)*bufferSize, (size_t)(end - start),
+                                                 MEM_BUFFERS);
+                *bufferSize = end - start;
+                if (*buffer == NULL) {
+                    printf("ERROR: Memory allocation failed\n");
+                    exit(1);
+                }
+            }
+            long out = 0;
+            for (long i = start; i < end; i++) {
+                (*buffer)[out++] = line[i];
+                if (line[i] == '"' && i + 1 < end && line[i + 1] == '"') {
+                    i++;
+                }
+            }
+            *field = *buffer;
+            *fieldLength = out;
+            return 1;
+        }
+
+        if (pos >= length) {
+            return 0;   // The line has fewer fields
+        }
+        pos++;   // Step over the separator
+    }
+}
+
+// scanText - Walks the whole file once, line by line, splitting each line
+// into words as it goes
+// Words are runs of bytes that are not CLASS_SEPARATOR in scan->charClass. By
+// default that is whitespace, exactly as fscanf("%s") reads words (a word
+// never contains a newline, so splitting per line loses nothing).
+// With stripPunct, punctuation is trimmed off both ends of each word and
+// words that were all punctuation are dropped. Stopwords are never inserted;
+// unless countStopwords is set they are dropped from totals and positions too.
+// Lines are newline-separated with the newline stripped, as fgets() read them;
+// a final line with no trailing newline still counts.
+// With a line filter, only lines that pass are counted or tokenized, and
+// word/line positions count only those lines (as if piped through grep).
+// With scan->column set, each line's one field stands in for its words (see
+// findField) and takes the line's position instead of a word position.
+// With scan->wordTable/lineTable set, counts go into those tables (which may
+// already hold another file's counts) and no lists are produced.
+// Parameters:
+//   data, size: The file contents
+//   scan: Says which lists/histograms to build and receives the results
+void scanText(const char *data, long size, TEXT_SCAN *scan) {
+    int wordIndex = 0;  // Track which word we're on (0-indexed)
+    int lineIndex = 0;  // Track which line we're on (0-indexed)
+    int wantWords = scan->buildWordList || scan->wordLengths != NULL;
+    const unsigned char *charClass = scan->charClass;
+    long lineStart = 0;
+    WORD_TABLE ownWordTable;
+    WORD_TABLE ownLineTable;
+    WORD_TABLE *wordTable = (scan->wordTable != NULL) ? scan->wordTable : &ownWordTable;
+    WORD_TABLE *lineTable = (scan->lineTable != NULL) ? scan->lineTable : &ownLineTable;
+    char *fieldBuffer = NULL;     // --column: where quoted fields are unescaped
+    long fieldBufferSize = 0;
+
+    scan->wordHead = NULL;
+    scan->lineHead = NULL;
+    scan->totalWords = 0;
+    scan->uniqueWords = 0;
+    scan->totalLines = 0;
+    scan->uniqueLines = 0;
+
+    if (scan->buildWordList && scan->wordTable == NULL) {
+        initWordTable(&ownWordTable, scan->foldCase, scan->printLowercase);
+        ownWordTable.recordPositions = scan->recordPositions;
+        ownWordTable.sortOrder = scan->sortOrder;
+        ownWordTable.sortDescending = scan->sortDescending;
+    }
+    if (scan->buildLineList && scan->lineTable == NULL) {
+        initWordTable(&ownLineTable, scan->foldCase, scan->printLowercase);
+        ownLineTable.sortOrder = scan->sortOrder;
+        ownLineTable.sortDescending = scan->sortDescending;
+    }
+
+    while (lineStart < size) {
+        // Find the end of this line
+        const char *newline = (const char *)memchr(data + lineStart, '\n',
+                                                   (size_t)(size - lineStart));
+        long lineEnd = (newline != NULL) ? (long)(newline - data) : size;
+
+        // --match: lines that don't pass are skipped entirely, as if they had
+        // been filtered out before the file was read
+        if (scan->lineFilter != NULL &&
+            !lineMatches(scan->lineFilter, data + lineStart, lineEnd - lineStart)) {
+            lineStart = lineEnd + 1;
+            continue;
+        }
+
+        // --column: the one field is this row's only "word", at the row's position
+        if (wantWords && scan->column > 0) {
+            const char *field;
+            long fieldLength;
+            if (findField(data + lineStart, lineEnd - lineStart, scan->column, scan->separator,
+                          &fieldBuffer, &fieldBufferSize, &field, &fieldLength)) {
+                countWordToken(scan, wordTable, field, fieldLength, lineIndex);
+            }
+        }
+
+        // Split the line into words
+        else if (wantWords) {
+            long pos = lineStart;
+            while (pos < lineEnd) {
+                // Skip leading separators
+                while (pos < lineEnd && (charClass[(unsigned char)data[pos]] & CLASS_SEPARATOR)) {
+                    pos++;
+                }
+                if (pos >= lineEnd) {
+                    break;
+                }
+
+                // Collect the word
+                long wordStart = pos;
+                while (pos < lineEnd && !(charClass[(unsigned char)data[pos]] & CLASS_SEPARATOR)) {
+                    pos++;
+                }
+                long wordEnd = pos;
+
+                // --strip-punct: trim punctuation off both ends
+                if (scan->stripPunct) {
+                    while (wordStart < wordEnd &&
+                           (charClass[(unsigned char)data[wordStart]] & CLASS_PUNCT)) {
+                        wordStart++;
+                    }
+                    while (wordEnd > wordStart &&
+                           (charClass[(unsigned char)data[wordEnd - 1]] & CLASS_PUNCT)) {
+                        wordEnd--;
+                    }
+                    if (wordStart == wordEnd) {
+                        continue;  // Nothing but punctuation - not a word
+                    }
+                }
+
+                // Move to next word position unless it was dropped as a stopword
+                wordIndex += countWordToken(scan, wordTable, data + wordStart,
+                                            wordEnd - wordStart, wordIndex);
+            }
+        }
+
+        // Record the line itself (without its newline)
+        scan->totalLines++;
+        if (scan->lineLengths != NULL) {
+            addToHistogram(scan->lineLengths, lineEnd - lineStart);
+        }
+        if (scan->buildLineList) {
+            insertLine(lineTable, data + lineStart, (int)(lineEnd - lineStart), lineIndex);
+        }
+        lineIndex++;
+
+        lineStart = lineEnd + 1;
+    }
+
+    trackedFree(fieldBuffer, (size_t)fieldBufferSize, MEM_BUFFERS);
+
+    // --stats: counting ends here
+    if (scan->stats != NULL) {
+        noteTableSize(scan->stats, scan->buildWordList ? wordTable : NULL,
+                      scan->buildLineList ? lineTable : NULL);
+        markPhase(scan->stats, PHASE_SCAN);
+    }
+
+    // Sort the lists now that counting is done (a caller's table is left as is)
+    if (scan->buildWordList && scan->wordTable == NULL) {
+        scan->uniqueWords = ownWordTable.uniqueCount;
+        scan->wordHead = finishWordTable(&ownWordTable);
+    }
+    if (scan->buildLineList && scan->lineTable == NULL) {
+        scan->uniqueLines = ownLineTable.uniqueCount;
+        scan->lineHead = finishWordTable(&ownLineTable);
+    }
+
+    if (scan->stats != NULL) {
+        markPhase(scan->stats, PHASE_SORT);
+    }
+}
+
+// =============================================================================
+// STOPWORD FUNCTIONS
+// =============================================================================
+
+// stopwordPrefilterBit - Which prefilter bit a word maps to
+int stopwordPrefilterBit(const char *word, int length, int foldCase) {
+    unsigned char first = (unsigned char)word[0];
+    if (foldCase && first >= 'A' && first <= 'Z') {
+        first += 'a' - 'A';
+    }
+    return (length & 31) * BYTE_RANGE + first;
+}
+
+// addStopword - Adds one word to the set (duplicates are ignored)
+void addStopword(STOPWORD_SET *set, const char *word, int length) {
+    if (isStopword(set, word, length)) {
+        return;
+    }
+
+    if ((set->count + 1) * 2 > set->tableSize) {
+        // Grow: rehash every entry into a table twice the size
+        int newSize = set->tableSize * 2;
+        STOPWORD *newSlots = (STOPWORD *)trackedCalloc((size_t)newSize, sizeof(STOPWORD), MEM_TABLES);
+        if (newSlots == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+        for (int i = 0; i < set->tableSize; i++) {
+            if (set->slots[i].text != NULL) {
+                uint32_t slot = set->slots[i].hashValue & (uint32_t)(newSize - 1);
+                while (newSlots[slot].text != NULL) {
+                    slot = (slot + 1) & (uint32_t)(newSize - 1);
+                }
+                newSlots[slot] = set->slots[i];
+            }
+        }
+        trackedFree(set->slots, sizeof(STOPWORD) * (size_t)set->tableSize, MEM_TABLES);
+        set->slots = newSlots;
+        set->tableSize = newSize;
+    }
+
+    uint32_t hashValue = hashToken(word, length, set->foldCase);
+    uint32_t slot = hashValue & (uint32_t)(set->tableSize - 1);
+    while (set->slots[slot].text != NULL) {
+        slot = (slot + 1) & (uint32_t)(set->tableSize - 1);
+    }
+    set->slots[slot].text = word;
+    set->slots[slot].length = length;
+    set->slots[slot].hashValue = hashValue;
+    set->count++;
+
+    int bit = stopwordPrefilterBit(word, length, set->foldCase);
+    set->prefilter[bit >> 3] |= (unsigned char)(1 << (bit & 7));
+}
+
+// loadStopwords - Reads a stopword file: whitespace-separated words, any layout
+// With foldCase (-i) stopwords match regardless of ASCII case
+// Returns: 1 on success, 0 if the file can't be opened
+int loadStopwords(STOPWORD_SET *set, const char *filename, int foldCase) {
+    memset(set, 0, sizeof(STOPWORD_SET));
+    set->foldCase = foldCase;
+
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < 0) {
+        size = 0;
+    }
+    long length = 0;
+    set->text = readInputFile(fp, size, &length);
+    set->textSize = size;
+    fclose(fp);
+
+    set->tableSize = 64;
+    set->slots = (STOPWORD *)trackedCalloc((size_t)set->tableSize, sizeof(STOPWORD), MEM_TABLES);
+    if (set->slots == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+
+    unsigned char charClass[BYTE_RANGE];
+    buildCharClassTable(charClass, NULL, 0);
+    long pos = 0;
+    while (pos < length) {
+        while (pos < length && (charClass[(unsigned char)set->text[pos]] & CLASS_SEPARATOR)) {
+            pos++;
+        }
+        long start = pos;
+        while (pos < length && !(charClass[(unsigned char)set->text[pos]] & CLASS_SEPARATOR)) {
+            pos++;
+        }
+        if (pos > start) {
+            addStopword(set, set->text + start, (int)(pos - start));
+        }
+    }
+    return 1;
+}
+
+// isStopword - Returns 1 if the word is in the set
+int isStopword(STOPWORD_SET *set, const char *word, int length) {
+    int bit = stopwordPrefilterBit(word, length, set->foldCase);
+    if (!((set->prefilter[bit >> 3] >> (bit & 7)) & 1)) {
+        return 0;   // No stopword has this length and first letter
+    }
+
+    uint32_t hashValue = hashToken(word, length, set->foldCase);
+    uint32_t mask = (uint32_t)(set->tableSize - 1);
+    uint32_t slot = hashValue & mask;
+    while (set->slots[slot].text != NULL) {
+        if (set->slots[slot].hashValue == hashValue && set->slots[slot].length == length &&
+            tokensEqual(set->slots[slot].text, word, length, set->foldCase)) {
+            return 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return 0;
+}
+
+// freeStopwords - Releases a stopword set
+void freeStopwords(STOPWORD_SET *set) {
+    trackedFree(set->slots, sizeof(STOPWORD) * (size_t)set->tableSize, MEM_TABLES);
+    trackedFree(set->text, (size_t)set->textSize + 1, MEM_BUFFERS);
+    set->slots = NULL;
+    set->text = NULL;
+}
+
+// =============================================================================
+// TIME BUCKET FUNCTIONS
+// =============================================================================
+
+// parseTimeBucketSpec - Parses a --time-buckets spec such as "iso,1m"
+// The width is a positive number with an optional unit: s (default), m, h, d
+// Returns: 1 if the spec is valid, 0 otherwise
+int parseTimeBucketSpec(const char *spec, int *format, long long *width) {
+    const char *comma = strchr(spec, ',');
+    if (comma == NULL) {
+        return 0;
+    }
+
+    size_t nameLength = (size_t)(comma - spec);
+    if (nameLength == 3 && strncmp(spec, "iso", 3) == 0) {
+        *format = TS_ISO;
+    } else if (nameLength == 6 && strncmp(spec, "syslog", 6) == 0) {
+        *format = TS_SYSLOG;
+    } else if (nameLength == 5 && strncmp(spec, "epoch", 5) == 0) {
+        *format = TS_EPOCH;
+    } else {
+        return 0;
+    }
+
+    const char *widthText = comma + 1;
+    char *end = NULL;
+    long long value = strtoll(widthText, &end, 10);
+    if (end == widthText || value <= 0) {
+        return 0;
+    }
+
+    long long unit = 1;
+    if (*end == 'm') {
+        unit = 60;
+        end++;
+    } else if (*end == 'h') {
+        unit = 3600;
+        end++;
+    } else if (*end == 'd') {
+        unit = 86400;
+        end++;
+    } else if (*end == 's') {
+        end++;
+    }
+    if (*end != '\0' || value > 1000000000LL) {
+        return 0;
+    }
+
+    *width = value * unit;
+    return 1;
+}
+
+// parseFixedDigits - Reads exactly count decimal digits
+// Returns: 1 if all count characters were digits, 0 otherwise
+int parseFixedDigits(const char *text, int count, int *value) {
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return 0;
+        }
+        result = result * 10 + (text[i] - '0');
+    }
+    *value = result;
+    return 1;
+}
+
+// daysFromCivil - Days from 1970-01-01 to a proleptic Gregorian date
+// Uses 400-year eras so no calendar tables or mktime() (which would apply the
+// local time zone) are needed
+long long daysFromCivil(int year, int month, int day) {
+    year -= (month <= 2);
+    long long era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = (int)(year - era * 400);
+    int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+// civilFromDays - Inverse of daysFromCivil
+void civilFromDays(long long days, int *year, int *month, int *day) {
+    days += 719468;
+    long long era = (days >= 0 ? days : days - 146096) / 146097;
+    int dayOfEra = (int)(days - era * 146097);
+    int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int monthIndex = (5 * dayOfYear + 2) / 153;
+    *day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    *month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    *year = (int)(yearOfEra + era * 400) + (*month <= 2);
+}
+
+// parseTimestamp - Reads the timestamp at the start of a line
+// Fixed formats only, checked byte by byte:
+//   TS_ISO:    YYYY-MM-DD[T ]HH:MM:SS, then optional .fraction and Z/+HH:MM
+//              (the offset is skipped, not applied: times bucket as written)
+//   TS_SYSLOG: Mmm dd HH:MM:SS (no year, so 1970 is assumed)
+//   TS_EPOCH:  seconds since 1970, then optional .fraction
+// Returns: Bytes used by the timestamp and the blanks after it, or 0 if the
+//          line doesn't start with one
+long parseTimestamp(const char *line, long length, int format, long long *seconds) {
+    static const char *monthNames = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    int year = 1970, month = 1, day = 1, hour = 0, minute = 0, second = 0;
+    long pos = 0;
+
+    if (format == TS_EPOCH) {
+        long long value = 0;
+        while (pos < length && pos < 18 && line[pos] >= '0' && line[pos] <= '9') {
+            value = value * 10 + (line[pos] - '0');
+            pos++;
+        }
+        if (pos == 0 || (pos < length && line[pos] >= '0' && line[pos] <= '9')) {
+            return 0;
+        }
+        *seconds = value;
+    } else {
+        if (format == TS_ISO) {
+            if (length < 19 || !parseFixedDigits(line, 4, &year) || line[4] != '-' ||
+                !parseFixedDigits(line + 5, 2, &month) || line[7] != '-' ||
+                !parseFixedDigits(line + 8, 2, &day) ||
+                (line[10] != 'T' && line[10] != ' ')) {
+                return 0;
+            }
+            pos = 11;
+        } else {
+            if (length < 15 || line[3] != ' ') {
+                return 0;
+            }
+            month = 0;
+            for (int i = 0; i < 12; i++) {
+                if (strncmp(line, monthNames + i * 3, 3) == 0) {
+                    month = i + 1;
+                    break;
+                }
+            }
+            // The day is two columns wide: " 1", "01" or "12"
+            char dayText[2] = { line[4] == ' ' ? '0' : line[4], line[5] };
+            if (month == 0 || !parseFixedDigits(dayText, 2, &day) || line[6] != ' ') {
+                return 0;
+            }
+            pos = 7;
+        }
+
+        if (!parseFixedDigits(line + pos, 2, &hour) || line[pos + 2] != ':' ||
+            !parseFixedDigits(line + pos + 3, 2, &minute) || line[pos + 5] != ':' ||
+            !parseFixedDigits(line + pos + 6, 2, &second)) {
+            return 0;
+        }
+        pos += 8;
+
+        if (month < 1 || month > 12 || day < 1 || day > 31 ||
+            hour > 23 || minute > 59 || second > 60) {
+            return 0;
+        }
+        *seconds = daysFromCivil(year, month, day) * 86400 +
+                   hour * 3600 + minute * 60 + second;
+    }
+
+    // Fractional seconds and (ISO only) a zone designator are skipped
+    if (format != TS_SYSLOG && pos < length && (line[pos] == '.' || line[pos] == ',')) {
+        pos++;
+        while (pos < length && line[pos] >= '0' && line[pos] <= '9') {
+            pos++;
+        }
+    }
+    if (format == TS_ISO && pos < length) {
+        if (line[pos] == 'Z') {
+            pos++;
+        } else if (line[pos] == '+' || line[pos] == '-') {
+            pos++;
+            while (pos < length && ((line[pos] >= '0' && line[pos] <= '9') || line[pos] == ':')) {
+                pos++;
+            }
+        }
+    }
+
+    // The timestamp must end at a blank (or the end of the line)
+    if (pos < length && line[pos] != ' ' && line[pos] != '\t' && line[pos] != '\r') {
+        return 0;
+    }
+    while (pos < length && (line[pos] == ' ' || line[pos] == '\t')) {
+        pos++;
+    }
+    return pos;
+}
+
+// formatBucketStart - Writes a bucket's start time in the input's own format
+void formatBucketStart(char *buffer, size_t bufferSize, long long start, int format) {
+    static const char *monthNames = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    if (format == TS_EPOCH) {
+        snprintf(buffer, bufferSize, "%lld", start);
+        return;
+    }
+
+    long long days = start / 86400;
+    long long secondOfDay = start % 86400;
+    if (secondOfDay < 0) {
+        secondOfDay += 86400;
+        days--;
+    }
+    int year, month, day;
+    civilFromDays(days, &year, &month, &day);
+    int hour = (int)(secondOfDay / 3600);
+    int minute = (int)(secondOfDay / 60 % 60);
+    int second = (int)(secondOfDay % 60);
+
+    if (format == TS_ISO) {
+        snprintf(buffer, bufferSize, "%04d-%02d-%02dT%02d:%02d:%02d",
+                 year, month, day, hour, minute, second);
+    } else {
+        snprintf(buffer, bufferSize, "%.3s %2d %02d:%02d:%02d",
+                 monthNames + (month - 1) * 3, day, hour, minute, second);
+    }
+}
+
+// findOrAddBucket - Returns the index of the bucket starting at start,
+// adding it if this is the first line seen for it
+int findOrAddBucket(BUCKET_SET *set, long long start) {
+    uint32_t mask = (uint32_t)(set->tableSize - 1);
+    uint32_t slot = (uint32_t)(((uint64_t)start * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    while (set->slots[slot] >= 0) {
+        if (set->buckets[set->slots[slot]].start == start) {
+            return set->slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    // New bucket
+    if (set->count == set->capacity) {
+        set->buckets = (TIME_BUCKET *)trackedRealloc(set->buckets,
+                                                     sizeof(TIME_BUCKET) * (size_t)set->capacity,
+                                                     sizeof(TIME_BUCKET) * (size_t)set->capacity * 2,
+                                                     MEM_TABLES);
+        set->capacity *= 2;
+        if (set->buckets == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    int index = set->count++;
+    memset(&set->buckets[index], 0, sizeof(TIME_BUCKET));
+    set->buckets[index].start = start;
+    set->slots[slot] = index;
+
+    // Keep the index at most half full
+    if (set->count * 2 > set->tableSize) {
+        int newSize = set->tableSize * 2;
+        int *newSlots = (int *)trackedMalloc(sizeof(int) * (size_t)newSize, MEM_TABLES);
+        if (newSlots == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+        memset(newSlots, 0xFF, sizeof(int) * (size_t)newSize);
+        for (int i = 0; i < set->count; i++) {
+            uint32_t newSlot = (uint32_t)(((uint64_t)set->buckets[i].start *
+                                           0x9E3779B97F4A7C15ULL) >> 32) & (uint32_t)(newSize - 1);
+            while (newSlots[newSlot] >= 0) {
+                newSlot = (newSlot + 1) & (uint32_t)(newSize - 1);
+            }
+            newSlots[newSlot] = i;
+        }
+        trackedFree(set->slots, sizeof(int) * (size_t)set->tableSize, MEM_TABLES);
+        set->slots = newSlots;
+        set->tableSize = newSize;
+    }
+    return index;
+}
+
+// groupLinesByBucket - Copies the file's lines into one buffer, grouped by bucket
+// Each line goes to the bucket its timestamp falls in; lines with no
+// timestamp (continuations, stack traces) stay with the line before them, and
+// lines before the first timestamp are skipped. The timestamp itself is cut
+// off, so words and lines are the message only. Two passes over the data, a
+// counting sort: the first sizes each bucket, the second copies lines into
+// place, so a bucket's lines end up contiguous and in file order.
+// Returns: The grouped copy (caller frees it); set->buckets says where each
+//          bucket's lines are, sorted by start time
+char* groupLinesByBucket(const char *data, long size, int format, long long width,
+                         BUCKET_SET *set) {
+    memset(set, 0, sizeof(BUCKET_SET));
+    set->capacity = BUCKET_TABLE_START;
+    set->tableSize = BUCKET_TABLE_START;
+    set->buckets = (TIME_BUCKET *)trackedMalloc(sizeof(TIME_BUCKET) * (size_t)set->capacity,
+                                                MEM_TABLES);
+    set->slots = (int *)trackedMalloc(sizeof(int) * (size_t)set->tableSize, MEM_TABLES);
+    char *grouped = (char *)trackedMalloc((size_t)size + 2, MEM_BUFFERS);
+    if (set->buckets == NULL || set->slots == NULL || grouped == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+    memset(set->slots, 0xFF, sizeof(int) * (size_t)set->tableSize);
+
+    for (int pass = 0; pass < 2; pass++) {
+        int current = -1;   // Bucket of the most recent timestamped line
+        long lineStart = 0;
+        while (lineStart < size) {
+            const char *newline = (const char *)memchr(data + lineStart, '\n',
+                                                       (size_t)(size - lineStart));
+            long lineEnd = (newline != NULL) ? (long)(newline - data) : size;
+
+            long long seconds;
+            long stampLength = parseTimestamp(data + lineStart, lineEnd - lineStart,
+                                              format, &seconds);
+            if (stampLength > 0) {
+                long long start = seconds - seconds % width;
+                if (seconds % width < 0) {
+                    start -= width;   // Round down for times before 1970
+                }
+                current = findOrAddBucket(set, start);
+            }
+
+            if (current < 0) {
+                if (pass == 0) {
+                    set->skippedLines++;
+                }
+            } else {
+                TIME_BUCKET *bucket = &set->buckets[current];
+                long messageLength = lineEnd - lineStart - stampLength;
+                if (pass == 0) {
+                    bucket->size += messageLength + 1;
+                    bucket->lineCount++;
+                } else {
+                    char *to = grouped + bucket->offset + bucket->fill;
+                    memcpy(to, data + lineStart + stampLength, (size_t)messageLength);
+                    to[messageLength] = '\n';
+                    bucket->fill += messageLength + 1;
+                }
+            }
+            lineStart = lineEnd + 1;
+        }
+
+        if (pass == 0) {
+            // Lay the buckets out one after another
+            long offset = 0;
+            for (int i = 0; i < set->count; i++) {
+                set->buckets[i].offset = offset;
+                offset += set->buckets[i].size;
+            }
+        }
+    }
+
+    qsort(set->buckets, (size_t)set->count, sizeof(TIME_BUCKET), compareBuckets);
+    trackedFree(set->slots, sizeof(int) * (size_t)set->tableSize, MEM_TABLES);   // Stale once sorted
+    set->slots = NULL;
+    return grouped;
+}
+
+// compareBuckets - qsort comparator: earliest bucket first
+int compareBuckets(const void *a, const void *b) {
+    long long startA = ((const TIME_BUCKET *)a)->start;
+    long long startB = ((const TIME_BUCKET *)b)->start;
+    return (startA > startB) - (startA < startB);
+}
+
+// freeBucketSet - Releases a bucket set
+void freeBucketSet(BUCKET_SET *set) {
+    trackedFree(set->buckets, sizeof(TIME_BUCKET) * (size_t)set->capacity, MEM_TABLES);
+    trackedFree(set->slots, sizeof(int) * (size_t)set->tableSize, MEM_TABLES);
+    set->buckets = NULL;
+    set->slots = NULL;
+}
+
+// printTimeBuckets - Prints the word and line sections once per bucket
+// Each bucket is scanned with the same settings as a whole-file scan would
+// use (filters, tokenizer, stopwords), printed, and freed before the next one,
+// so only one bucket's word and line tables are in memory at a time.
+void printTimeBuckets(FILE *outputFile, OPTIONS *options, TEXT_SCAN *baseScan,
+                      const char *grouped, BUCKET_SET *set) {
+    fprintf(outputFile, "Total Number of Buckets: %d\n", set->count);
+    fprintf(outputFile, "Lines Before First Timestamp: %d\n", set->skippedLines);
+
+    for (int b = 0; b < set->count; b++) {
+        TIME_BUCKET *bucket = &set->buckets[b];
+        LENGTH_HISTOGRAM wordLengths;
+        LENGTH_HISTOGRAM lineLengths;
+        memset(&wordLengths, 0, sizeof(LENGTH_HISTOGRAM));
+        memset(&lineLengths, 0, sizeof(LENGTH_HISTOGRAM));
+
+        TEXT_SCAN scan = *baseScan;
+        scan.wordLengths = (baseScan->wordLengths != NULL) ? &wordLengths : NULL;
+        scan.lineLengths = (baseScan->lineLengths != NULL) ? &lineLengths : NULL;
+        scanText(grouped + bucket->offset, bucket->size, &scan);
+
+        char label[64];
+        formatBucketStart(label, sizeof(label), bucket->start, options->timeFormat);
+        fprintf(outputFile, "\nBucket: %s\n", label);
+
+        int firstSection = 1;
+        for (int i = 0; i < options->flagCount; i++) {
+            if (!isScanSection(options->flagOrder[i])) {
+                continue;
+            }
+            if (!firstSection) {
+                fprintf(outputFile, "\n");
+            }
+            if (printScanSection(outputFile, options->flagOrder[i], &scan)) {
+                firstSection = 0;
+            }
+        }
+
+        if (scan.wordHead != NULL) {
+            freeWordList(scan.wordHead);
+        }
+        if (scan.lineHead != NULL) {
+            freeLineList(scan.lineHead);
+        }
+    }
+}
+
+// =============================================================================
+// DIFF FUNCTIONS
+// =============================================================================
+
+// Ranking used by compareDiffEntries (qsort has no user pointer in C99)
+int diffRankMode = DIFF_RANK_ALPHA;
+
+// diffMagnitude - How far an entry's frequency moved between the two files
+long long diffMagnitude(const WORD *entry) {
+    long long change = (long long)entry->frequencyB - entry->frequency;
+    return (change < 0) ? -change : change;
+}
+
+// compareDiffEntries - qsort comparator for the --diff listing
+// DIFF_RANK_ALPHA: ASCII order. DIFF_RANK_ABS: biggest |B - A| first.
+// DIFF_RANK_REL: biggest |B - A| / A first, with A counted as 1 for new
+// entries (compared by cross-multiplying, so no floating point).
+// Ties are always broken alphabetically.
+int compareDiffEntries(const void *a, const void *b) {
+    const WORD *entryA = *(WORD * const *)a;
+    const WORD *entryB = *(WORD * const *)b;
+
+    if (diffRankMode != DIFF_RANK_ALPHA) {
+        long long keyA = diffMagnitude(entryA);
+        long long keyB = diffMagnitude(entryB);
+        if (diffRankMode == DIFF_RANK_REL) {
+            keyA *= (entryB->frequency > 0) ? entryB->frequency : 1;
+            keyB *= (entryA->frequency > 0) ? entryA->frequency : 1;
+        }
+        if (keyA != keyB) {
+            return (keyA > keyB) ? -1 : 1;
+        }
+    }
+    return compareTokens(entryA->contents, entryA->numChars, entryB->contents, entryB->numChars);
+}
+
+// countDiffFile - Counts the second --diff file into the tables already
+// holding the first file's counts (as frequencyB)
+// Returns: 1 on success, 0 on error (error message already printed)
+int countDiffFile(const char *filename, TEXT_SCAN *scan) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        printInputFileError();
+        return 0;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size == 0) {
+        printInputFileEmptyError();
+        fclose(fp);
+        return 0;
+    }
+
+    long length = 0;
+    char *data = readInputFile(fp, size, &length);
+    fclose(fp);
+
+    if (scan->wordTable != NULL) {
+        scan->wordTable->countSecond = 1;
+    }
+    if (scan->lineTable != NULL) {
+        scan->lineTable->countSecond = 1;
+    }
+    scanText(data, length, scan);
+
+    trackedFree(data, (size_t)size + 1, MEM_BUFFERS);
+    return 1;
+}
+
+// printDiffSection - Prints the entries whose frequency differs between the
+// two --diff files
+// Unchanged entries are skipped while walking the table, so only the changed
+// ones are ever gathered and sorted.
+void printDiffSection(FILE *outputFile, WORD_TABLE *table, const char *itemName,
+                      const char *pluralName, int totalA, int totalB, int rankMode) {
+    int uniqueA = 0, uniqueB = 0;
+    int changed = 0, added = 0, removed = 0;
+
+    WORD **entries = (WORD **)trackedMalloc(sizeof(WORD *) * (size_t)(table->uniqueCount + 1),
+                                            MEM_SORT);
+    if (entries == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+    int entryCount = 0;
+    for (WORD *current = table->head; current != NULL; current = current->nextWord) {
+        uniqueA += (current->frequency > 0);
+        uniqueB += (current->frequencyB > 0);
+        if (current->frequency == current->frequencyB) {
+            continue;
+        }
+        if (current->frequency == 0) {
+            added++;
+        } else if (current->frequencyB == 0) {
+            removed++;
+        } else {
+            changed++;
+        }
+        entries[entryCount++] = current;
+    }
+
+    diffRankMode = rankMode;
+    qsort(entries, (size_t)entryCount, sizeof(WORD *), compareDiffEntries);
+    diffRankMode = DIFF_RANK_ALPHA;
+
+    fprintf(outputFile, "%s Diff:\n", itemName);
+    fprintf(outputFile, "Total Number of %s: A = %d, B = %d\n", pluralName, totalA, totalB);
+    fprintf(outputFile, "Total Unique %s: A = %d, B = %d\n", pluralName, uniqueA, uniqueB);
+    fprintf(outputFile, "Changed: %d, Added: %d, Removed: %d\n\n", changed, added, removed);
+
+    for (int i = 0; i < entryCount; i++) {
+        fprintf(outputFile, "%s: ", itemName);
+        printToken(outputFile, "", entries[i]->contents, entries[i]->numChars);
+        fprintf(outputFile, ", Freq A: %d, Freq B: %d, Change: %+d\n",
+                entries[i]->frequency, entries[i]->frequencyB,
+                entries[i]->frequencyB - entries[i]->frequency);
+    }
+
+    trackedFree(entries, sizeof(WORD *) * (size_t)(table->uniqueCount + 1), MEM_SORT);
+}
+
+// =============================================================================
+// PRESORTED LINE FUNCTIONS
+// =============================================================================
+
+// compareLineBytes - strcmp() order for lines that aren't NUL-terminated
+int compareLineBytes(const char *a, long lengthA, const char *b, long lengthB) {
+    int order = memcmp(a, b, (size_t)((lengthA < lengthB) ? lengthA : lengthB));
+    if (order != 0) {
+        return order;
+    }
+    return (lengthA > lengthB) - (lengthA < lengthB);
+}
+
+// checkSortedLines - Checks that the (filtered) lines are already in ASCII
+// order, counting them on the way
+// In sorted input equal lines are adjacent, so comparing each line with the
+// one before it is enough to count unique lines; no table is needed.
+// Returns: 1 if the lines are in order (stats filled in), 0 at the first
+//          line that is out of order
+int checkSortedLines(const char *data, long size, LINE_FILTER *filter, SORTED_LINES *stats) {
+    const char *previous = NULL;
+    long previousLength = 0;
+    long lineStart = 0;
+
+    memset(stats, 0, sizeof(SORTED_LINES));
+    while (lineStart < size) {
+        const char *newline = (const char *)memchr(data + lineStart, '\n',
+                                                   (size_t)(size - lineStart));
+        long lineEnd = (newline != NULL) ? (long)(newline - data) : size;
+        const char *line = data + lineStart;
+        long length = lineEnd - lineStart;
+        lineStart = lineEnd + 1;
+
+        if (filter != NULL && !lineMatches(filter, line, length)) {
+            continue;
+        }
+
+        if (previous == NULL) {
+            stats->uniqueLines++;
+        } else {
+            int order = compareLineBytes(previous, previousLength, line, length);
+            if (order > 0) {
+                return 0;   // Out of order
+            }
+            if (order < 0) {
+                stats->uniqueLines++;
+            }
+        }
+        stats->totalLines++;
+        if (length > stats->longestLength) {
+            stats->longestLength = length;
+        }
+        previous = line;
+        previousLength = length;
+    }
+    return 1;
+}
+
+// printSortedLines - Prints -l (or, with longestOnly, -Ll) for lines that
+// checkSortedLines() found in order
+// Walks the lines again and prints each run of equal lines as it ends, so
+// the output is the same as from a line table without building one.
+// Returns: 1 if anything was printed
+int printSortedLines(FILE *outputFile, const char *data, long size, LINE_FILTER *filter,
+                     SORTED_LINES *stats, int longestOnly) {
+    if (longestOnly) {
+        if (stats->totalLines == 0) {
+            return 0;
+        }
+        fprintf(outputFile, "Longest Line is %ld characters long:\n", stats->longestLength);
+    } else {
+        fprintf(outputFile, "Total Number of Lines: %d\n", stats->totalLines);
+        fprintf(outputFile, "Total Unique Lines: %d\n\n", stats->uniqueLines);
+    }
+
+    const char *run = NULL;     // First line of the current run of equal lines
+    long runLength = 0;
+    int runCount = 0;
+    int runPosition = 0;
+    int lineIndex = 0;
+    long lineStart = 0;
+    int atEnd = 0;
+    while (!atEnd) {
+        const char *line = NULL;
+        long length = 0;
+        if (lineStart < size) {
+            const char *newline = (const char *)memchr(data + lineStart, '\n',
+                                                       (size_t)(size - lineStart));
+            long lineEnd = (newline != NULL) ? (long)(newline - data) : size;
+            line = data + lineStart;
+            length = lineEnd - lineStart;
+            lineStart = lineEnd + 1;
+            if (filter != NULL && !lineMatches(filter, line, length)) {
+                continue;
+            }
+            if (run != NULL && length == runLength && memcmp(line, run, (size_t)length) == 0) {
+                runCount++;
+                lineIndex++;
+                continue;
+            }
+        } else {
+            atEnd = 1;   // End of data: flush the last run
+        }
+
+        // A new line (or the end) finishes the current run
+        if (run != NULL) {
+            if (!longestOnly) {
+                printToken(outputFile, "Line: ", run, runLength);
+                fprintf(outputFile, ", Freq: %d, Initial Position: %d\n", runCount, runPosition);
+            } else if (runLength == stats->longestLength) {
+                printToken(outputFile, "\t", run, runLength);
+                fputc('\n', outputFile);
+            }
+        }
+        run = line;
+        runLength = length;
+        runCount = 1;
+        runPosition = lineIndex++;
+    }
+    return 1;
+}
+
+// =============================================================================
+// LINE FILTER FUNCTIONS
+// =============================================================================
+
+// findSubstring - Finds the first occurrence of needle in haystack
+// memchr() (which the C library vectorizes) jumps to each candidate first
+// byte; the candidate's last byte is checked before comparing the rest, so
+// most false starts cost two byte compares.
+// Returns: Pointer to the match, or NULL if there is none
+const char* findSubstring(const char *haystack, long length,
+                          const char *needle, int needleLength) {
+    if (needleLength == 0) {
+        return haystack;
+    }
+    if (needleLength > length) {
+        return NULL;
+    }
+
+    const char *lastStart = haystack + (length - needleLength);
+    const char *candidate = haystack;
+    char lastByte = needle[needleLength - 1];
+
+    while (candidate <= lastStart) {
+        candidate = (const char *)memchr(candidate, needle[0],
+                                         (size_t)(lastStart - candidate) + 1);
+        if (candidate == NULL) {
+            return NULL;
+        }
+        if (candidate[needleLength - 1] == lastByte &&
+            (needleLength <= 2 ||
+             memcmp(candidate + 1, needle + 1, (size_t)needleLength - 2) == 0)) {
+            return candidate;
+        }
+        candidate++;
+    }
+    return NULL;
+}
+
+// lineMatches - Returns 1 if a line passes the filter, 0 if not
+// The regex (if any) counts as one more pattern alongside the substrings;
+// it runs last since the substring checks are cheaper
+int lineMatches(LINE_FILTER *filter, const char *line, long length) {
+    for (int i = 0; i < filter->patternCount; i++) {
+        int found = findSubstring(line, length, filter->patterns[i],
+                                  filter->patternLengths[i]) != NULL;
+        if (filter->matchAny && found) {
+            return 1;   // OR: one hit is enough
+        }
+        if (!filter->matchAny && !found) {
+            return 0;   // AND: one miss is enough
+        }
+    }
+    if (filter->regex != NULL) {
+        return regexMatchesLine(filter->regex, (const unsigned char *)line, length);
+    }
+    // AND: every pattern was found / OR: none was
+    return !filter->matchAny || filter->patternCount == 0;
+}
+
+// keepMatchingLines - Copies just the lines that pass the filter
+// Used for --match-chars, so character analysis sees the same text the word
+// and line analysis do. Each kept line keeps its newline (if it had one).
+// Returns: The new buffer (caller frees it), with its length in newSize
+char* keepMatchingLines(const char *data, long size, LINE_FILTER *filter, long *newSize) {
+    char *kept = (char *)trackedMalloc((size_t)size + 1, MEM_BUFFERS);
+    if (kept == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+
+    long keptSize = 0;
+    long lineStart = 0;
+    while (lineStart < size) {
+        const char *newline = (const char *)memchr(data + lineStart, '\n',
+                                                   (size_t)(size - lineStart));
+        long lineEnd = (newline != NULL) ? (long)(newline - data) : size;
+        long nextStart = (newline != NULL) ? lineEnd + 1 : size;
+
+        if (lineMatches(filter, data + lineStart, lineEnd - lineStart)) {
+            memcpy(kept + keptSize, data + lineStart, (size_t)(nextStart - lineStart));
+            keptSize += nextStart - lineStart;
+        }
+        lineStart = nextStart;
+    }
+
+    kept[keptSize] = '\0';
+    *newSize = keptSize;
+    return kept;
+}
+
+// =============================================================================
+// REGEX FUNCTIONS
+// =============================================================================
+// --regex patterns are compiled to an NFA with Thompson's construction and
+// matched with a DFA that is built lazily, one transition at a time, while
+// lines are scanned. Matching never backtracks: each byte of a line costs one
+// table lookup once the DFA states it needs exist.
+//
+// Supported syntax (POSIX ERE style):
+//   c        literal byte          .        any byte
+//   [abc]    byte class            [^a-z]   negated class, with ranges
+//   \d \w \s digit, word, space    \D \W \S their complements
+//   \t \n \r tab, newline, CR      \c       any other byte literally
+//   x*  x+  x?                     zero or more / one or more / optional
+//   x|y                            alternation
+//   ( )                            grouping
+//   ^  $                           start / end of line
+// A line matches if the pattern matches anywhere in it.
+
+// addRegexState - Appends a new NFA state and returns its number
+int addRegexState(REGEX *regex, int type) {
+    if (regex->stateCount == regex->stateCapacity) {
+        int newCapacity = (regex->stateCapacity == 0) ? 64 : regex->stateCapacity * 2;
+        REGEX_STATE *newStates = (REGEX_STATE *)trackedRealloc(regex->states,
+                                             sizeof(REGEX_STATE) * regex->stateCapacity,
+                                             sizeof(REGEX_STATE) * newCapacity, MEM_TABLES);
+        if (newStates == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+        regex->states = newStates;
+        regex->stateCapacity = newCapacity;
+    }
+
+    REGEX_STATE *state = &regex->states[regex->stateCount];
+    memset(state, 0, sizeof(REGEX_STATE));
+    state->type = type;
+    state->out = -1;
+    state->out1 = -1;
+    return regex->stateCount++;
+}
+
+// parseRegexAlternation - Parses "a|b|c" starting at *pattern
+// Each parse function builds an NFA fragment and returns its start state;
+// *end receives the fragment's last state, whose out is still -1 so the
+// caller can connect it to whatever follows.
+// Returns: Start state, or -1 on a syntax error
+int parseRegexAlternation(REGEX *regex, const char **pattern, int depth, int *end) {
+    int start = parseRegexSequence(regex, pattern, depth, end);
+    if (start < 0) {
+        return -1;
+    }
+
+    while (**pattern == '|') {
+        (*pattern)++;
+        int rightEnd;
+        int right = parseRegexSequence(regex, pattern, depth, &rightEnd);
+        if (right < 0) {
+            return -1;
+        }
+
+        // Branch to either side, then join both ends
+        int split = addRegexState(regex, RX_SPLIT);
+        int join = addRegexState(regex, RX_EMPTY);
+        regex->states[split].out = start;
+        regex->states[split].out1 = right;
+        regex->states[*end].out = join;
+        regex->states[rightEnd].out = join;
+        start = split;
+        *end = join;
+    }
+    return start;
+}
+
+// parseRegexSequence - Parses a run of atoms up to "|", ")" or the end
+// An empty sequence (as in "a|" or "()") is allowed and matches nothing
+int parseRegexSequence(REGEX *regex, const char **pattern, int depth, int *end) {
+    int start = addRegexState(regex, RX_EMPTY);
+    int last = start;
+
+    while (**pattern != '\0' && **pattern != '|' && **pattern != ')') {
+        int atomEnd;
+        int atom = parseRegexRepeat(regex, pattern, depth, &atomEnd);
+        if (atom < 0) {
+            return -1;
+        }
+        regex->states[last].out = atom;
+        last = atomEnd;
+    }
+
+    *end = last;
+    return start;
+}
+
+// parseRegexRepeat - Parses an atom followed by any number of * + ?
+int parseRegexRepeat(REGEX *regex, const char **pattern, int depth, int *end) {
+    int start = parseRegexAtom(regex, pattern, depth, end);
+    if (start < 0) {
+        return -1;
+    }
+
+    while (**pattern == '*' || **pattern == '+' || **pattern == '?') {
+        char op = **pattern;
+        (*pattern)++;
+
+        int split = addRegexState(regex, RX_SPLIT);
+        int newEnd = addRegexState(regex, RX_EMPTY);
+        regex->states[split].out = start;     // Go (back) through the atom...
+        regex->states[split].out1 = newEnd;   // ...or skip past it
+
+        if (op == '*') {
+            regex->states[*end].out = split;  // Loop back after each pass
+            start = split;
+        } else if (op == '+') {
+            regex->states[*end].out = split;  // Must pass once, then may loop
+        } else {
+            regex->states[*end].out = newEnd; // At most once
+            start = split;
+        }
+        *end = newEnd;
+    }
+
+    if (**pattern == '{') {
+        return -1;       // {m,n} counted repeats aren't supported
+    }
+    return start;
+}
+
+// addRegexEscapeSet - Adds the bytes a backslash escape stands for
+void addRegexEscapeSet(char escape, unsigned char byteSet[]) {
+    unsigned char members[BYTE_RANGE];
+    int negate = (escape == 'D' || escape == 'W' || escape == 'S');
+    char lower = negate ? (char)(escape + ('a' - 'A')) : escape;
+
+    if (lower != 'd' && lower != 'w' && lower != 's') {
+        // Not a class: the escaped byte itself (with the usual control escapes)
+        unsigned char c = (unsigned char)escape;
+        if (escape == 't') {
+            c = '\t';
+        } else if (escape == 'n') {
+            c = '\n';
+        } else if (escape == 'r') {
+            c = '\r';
+        }
+        byteSet[c >> 3] |= (unsigned char)(1 << (c & 7));
+        return;
+    }
+
+    for (int c = 0; c < BYTE_RANGE; c++) {
+        int isDigit = (c >= '0' && c <= '9');
+        int isWord = isDigit || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+        int isSpace = (c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r');
+        members[c] = (unsigned char)((lower == 'd') ? isDigit : (lower == 'w') ? isWord : isSpace);
+        if (members[c] != negate) {
+            byteSet[c >> 3] |= (unsigned char)(1 << (c & 7));
+        }
+    }
+}
+
+// parseRegexClass - Parses a bracket expression; *pattern points just past "["
+// Returns: 1 on success (with *pattern just past "]"), 0 on a syntax error
+int parseRegexClass(REGEX *regex, const char **pattern, unsigned char byteSet[]) {
+    unsigned char members[32];
+    int negate = 0;
+    int first = 1;
+    (void)regex;
+
+    memset(members, 0, sizeof(members));
+    if (**pattern == '^') {
+        negate = 1;
+        (*pattern)++;
+    }
+
+    // A "]" right at the start is a literal, not the end of the class
+    while (**pattern != '\0' && (**pattern != ']' || first)) {
+        first = 0;
+        unsigned char low = (unsigned char)**pattern;
+        (*pattern)++;
+
+        if (low == '[' && **pattern == ':') {
+            return 0;    // [:class:] names aren't supported
+        }
+
+        if (low == '\\') {
+            if (**pattern == '\0') {
+                return 0;
+            }
+            char escape = **pattern;
+            (*pattern)++;
+            if (escape == 'd' || escape == 'w' || escape == 's' ||
+                escape == 'D' || escape == 'W' || escape == 'S') {
+                addRegexEscapeSet(escape, members);
+                continue;
+            }
+            low = (unsigned char)((escape == 't') ? '\t' : (escape == 'n') ? '\n' :
+                                  (escape == 'r') ? '\r' : escape);
+        }
+
+        // Range "a-z" (a "-" just before "]" is a literal)
+        unsigned char high = low;
+        if ((*pattern)[0] == '-' && (*pattern)[1] != ']' && (*pattern)[1] != '\0') {
+            high = (unsigned char)(*pattern)[1];
+            *pattern += 2;
+            if (high < low) {
+                return 0;
+            }
+        }
+        for (int c = low; c <= high; c++) {
+            members[c >> 3] |= (unsigned char)(1 << (c & 7));
+        }
+    }
+
+    if (**pattern != ']') {
+        return 0;   // Unterminated class
+    }
+    (*pattern)++;
+
+    for (int i = 0; i < 32; i++) {
+        byteSet[i] = negate ? (unsigned char)~members[i] : members[i];
+    }
+    return 1;
+}
+
+// parseRegexAtom - Parses one literal, class, anchor or ( group )
+int parseRegexAtom(REGEX *regex, const char **pattern, int depth, int *end) {
+    char c = **pattern;
+
+    if (c == '(') {
+        if (depth >= MAX_REGEX_DEPTH) {
+            return -1;
+        }
+        (*pattern)++;
+        int start = parseRegexAlternation(regex, pattern, depth + 1, end);
+        if (start < 0 || **pattern != ')') {
+            return -1;   // Unbalanced parentheses
+        }
+        (*pattern)++;
+        return start;
+    }
+
+    if (c == '*' || c == '+' || c == '?' || c == '{') {
+        return -1;       // Nothing to repeat
+    }
+
+    if (c == '^' || c == '$') {
+        (*pattern)++;
+        int state = addRegexState(regex, (c == '^') ? RX_BOL : RX_EOL);
+        *end = state;
+        return state;
+    }
+
+    int state = addRegexState(regex, RX_SET);
+    unsigned char *byteSet = regex->states[state].byteSet;
+    (*pattern)++;
+
+    if (c == '.') {
+        memset(byteSet, 0xFF, 32);
+        byteSet['\n' >> 3] &= (unsigned char)~(1 << ('\n' & 7));
+    } else if (c == '[') {
+        if (!parseRegexClass(regex, pattern, byteSet)) {
+            return -1;
+        }
+    } else if (c == '\\') {
+        if (**pattern == '\0') {
+            return -1;   // Pattern ends in a lone backslash
+        }
+        addRegexEscapeSet(**pattern, byteSet);
+        (*pattern)++;
+    } else {
+        unsigned char literal = (unsigned char)c;
+        byteSet[literal >> 3] |= (unsigned char)(1 << (literal & 7));
+    }
+
+    *end = state;
+    return state;
+}
+
+// compileRegex - Compiles a --regex pattern
+// Returns: The compiled regex (free with freeRegex), or NULL on a syntax error
+REGEX* compileRegex(const char *pattern) {
+    REGEX *regex = (REGEX *)trackedCalloc(1, sizeof(REGEX), MEM_TABLES);
+    if (regex == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+
+    // Build the NFA
+    const char *cursor = pattern;
+    int end;
+    int start = parseRegexAlternation(regex, &cursor, 0, &end);
+    if (start < 0 || *cursor != '\0') {
+        freeRegex(regex);
+        return NULL;
+    }
+    int match = addRegexState(regex, RX_MATCH);
+    regex->states[end].out = match;
+    regex->startState = start;
+
+    // Split the 256 byte values into classes the pattern can't tell apart,
+    // so the DFA needs one column per class instead of one per byte
+    memset(regex->byteClass, 0, sizeof(regex->byteClass));
+    regex->classCount = 1;
+    for (int i = 0; i < regex->stateCount; i++) {
+        if (regex->states[i].type != RX_SET) {
+            continue;
+        }
+        int remap[BYTE_RANGE * 2];
+        int newCount = 0;
+        for (int k = 0; k < BYTE_RANGE * 2; k++) {
+            remap[k] = -1;
+        }
+        for (int c = 0; c < BYTE_RANGE; c++) {
+            int inSet = (regex->states[i].byteSet[c >> 3] >> (c & 7)) & 1;
+            int key = regex->byteClass[c] * 2 + inSet;
+            if (remap[key] < 0) {
+                remap[key] = newCount++;
+            }
+            regex->byteClass[c] = (unsigned char)remap[key];
+        }
+        regex->classCount = newCount;
+    }
+
+    regex->transitions = (int *)trackedMalloc(sizeof(int) * MAX_DFA_STATES * regex->classCount,
+                                              MEM_TABLES);
+    regex->work = (int *)trackedMalloc(sizeof(int) * (regex->stateCount + 1), MEM_TABLES);
+    regex->workMark = (int *)trackedCalloc((size_t)regex->stateCount + 1, sizeof(int), MEM_TABLES);
+    if (regex->transitions == NULL || regex->work == NULL || regex->workMark == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+
+    // Start with an empty cache holding just the start state
+    flushDfaCache(regex);
+    return regex;
+}
+
+// freeRegex - Releases a compiled regex
+void freeRegex(REGEX *regex) {
+    if (regex == NULL) {
+        return;
+    }
+    for (int i = 0; i < regex->dfaCount; i++) {
+        trackedFree(regex->dfa[i].nfaStates, sizeof(int) * (regex->dfa[i].nfaCount + 1), MEM_TABLES);
+    }
+    trackedFree(regex->states, sizeof(REGEX_STATE) * regex->stateCapacity, MEM_TABLES);
+    trackedFree(regex->transitions, sizeof(int) * MAX_DFA_STATES * regex->classCount, MEM_TABLES);
+    trackedFree(regex->work, sizeof(int) * (regex->stateCount + 1), MEM_TABLES);
+    trackedFree(regex->workMark, sizeof(int) * (regex->stateCount + 1), MEM_TABLES);
+    trackedFree(regex, sizeof(REGEX), MEM_TABLES);
+}
+
+// addRegexClosure - Adds an NFA state and everything reachable from it by
+// epsilon moves to regex->work (only states that matter to the DFA are kept)
+// ^ can only be passed at the start of a line and $ only at its end; a $
+// that can't be passed yet stays in the set so the end-of-line check can
+// pass it later.
+// Returns: 1 if RX_MATCH was reached
+int addRegexClosure(REGEX *regex, int state, int atLineStart, int atLineEnd, int *count) {
+    if (state < 0 || regex->workMark[state] == regex->generation) {
+        return 0;
+    }
+    regex->workMark[state] = regex->generation;
+
+    REGEX_STATE *nfaState = &regex->states[state];
+    switch (nfaState->type) {
+        case RX_SPLIT:
+            return addRegexClosure(regex, nfaState->out, atLineStart, atLineEnd, count) |
+                   addRegexClosure(regex, nfaState->out1, atLineStart, atLineEnd, count);
+        case RX_EMPTY:
+            return addRegexClosure(regex, nfaState->out, atLineStart, atLineEnd, count);
+        case RX_BOL:
+            if (atLineStart) {
+                return addRegexClosure(regex, nfaState->out, atLineStart, atLineEnd, count);
+            }
+            return 0;
+        case RX_EOL:
+            if (atLineEnd) {
+                return addRegexClosure(regex, nfaState->out, atLineStart, atLineEnd, count);
+            }
+            regex->work[(*count)++] = state;
+            return 0;
+        case RX_MATCH:
+            regex->work[(*count)++] = state;
+            return 1;
+        default:
+            regex->work[(*count)++] = state;
+            return 0;
+    }
+}
+
+// compareInts - qsort comparator: ascending int
+int compareInts(const void *a, const void *b) {
+    int valueA = *(const int *)a;
+    int valueB = *(const int *)b;
+    return (valueA > valueB) - (valueA < valueB);
+}
+
+// findOrAddDfaState - Looks up the DFA state for a sorted set of NFA states,
+// creating it if needed
+// Returns: DFA state number, or -1 if it is new and the cache is full
+int findOrAddDfaState(REGEX *regex, int *nfaStates, int count) {
+    uint32_t hashValue = 2166136261u;
+    for (int i = 0; i < count; i++) {
+        hashValue = (hashValue ^ (uint32_t)nfaStates[i]) * 16777619u;
+    }
+
+    uint32_t slot = hashValue & (DFA_LOOKUP_SIZE - 1);
+    while (regex->lookup[slot] >= 0) {
+        DFA_STATE *existing = &regex->dfa[regex->lookup[slot]];
+        if (existing->hashValue == hashValue && existing->nfaCount == count &&
+            memcmp(existing->nfaStates, nfaStates, sizeof(int) * count) == 0) {
+            return regex->lookup[slot];
+        }
+        slot = (slot + 1) & (DFA_LOOKUP_SIZE - 1);
+    }
+
+    if (regex->dfaCount >= MAX_DFA_STATES) {
+        return -1;
+    }
+
+    int index = regex->dfaCount++;
+    DFA_STATE *state = &regex->dfa[index];
+    state->nfaStates = (int *)trackedMalloc(sizeof(int) * (count + 1), MEM_TABLES);
+    if (state->nfaStates == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(state->nfaStates, nfaStates, sizeof(int) * count);
+    state->nfaCount = count;
+    state->hashValue = hashValue;
+    regex->lookup[slot] = index;
+    for (int c = 0; c < regex->classCount; c++) {
+        regex->transitions[index * regex->classCount + c] = -1;
+    }
+
+    // Decide now whether this state matches, or would at the end of the line
+    state->accepting = 0;
+    state->acceptsAtEnd = 0;
+    int scratch = 0;
+    regex->generation++;
+    for (int i = 0; i < count; i++) {
+        int type = regex->states[state->nfaStates[i]].type;
+        if (type == RX_MATCH) {
+            state->accepting = 1;
+            state->acceptsAtEnd = 1;
+        } else if (type == RX_EOL) {
+            if (addRegexClosure(regex, regex->states[state->nfaStates[i]].out, 0, 1, &scratch)) {
+                state->acceptsAtEnd = 1;
+            }
+        }
+    }
+    return index;
+}
+
+// flushDfaCache - Forgets every cached DFA state and rebuilds the start state
+void flushDfaCache(REGEX *regex) {
+    for (int i = 0; i < regex->dfaCount; i++) {
+        trackedFree(regex->dfa[i].nfaStates, sizeof(int) * (regex->dfa[i].nfaCount + 1), MEM_TABLES);
+    }
+    regex->dfaCount = 0;
+    for (int i = 0; i < DFA_LOOKUP_SIZE; i++) {
+        regex->lookup[i] = -1;
+    }
+
+    int count = 0;
+    regex->generation++;
+    addRegexClosure(regex, regex->startState, 1, 0, &count);
+    qsort(regex->work, count, sizeof(int), compareInts);
+    regex->dfaStart = findOrAddDfaState(regex, regex->work, count);
+}
+
+// buildDfaTransition - Works out where DFA state "from" goes on a byte of the
+// given class, caching the answer
+// The start state is added back after every byte, which is what makes the
+// pattern match anywhere in the line rather than only at its start.
+// Returns: The next DFA state
+int buildDfaTransition(REGEX *regex, int from, int byteClass) {
+    // Any byte of this class will do as a representative
+    int representative = 0;
+    while (regex->byteClass[representative] != byteClass) {
+        representative++;
+    }
+
+    int count = 0;
+    regex->generation++;
+    DFA_STATE *state = &regex->dfa[from];
+    for (int i = 0; i < state->nfaCount; i++) {
+        REGEX_STATE *nfaState = &regex->states[state->nfaStates[i]];
+        if (nfaState->type == RX_SET &&
+            ((nfaState->byteSet[representative >> 3] >> (representative & 7)) & 1)) {
+            addRegexClosure(regex, nfaState->out, 0, 0, &count);
+        }
+    }
+    addRegexClosure(regex, regex->startState, 0, 0, &count);
+    qsort(regex->work, count, sizeof(int), compareInts);
+
+    int next = findOrAddDfaState(regex, regex->work, count);
+    if (next >= 0) {
+        regex->transitions[from * regex->classCount + byteClass] = next;
+        return next;
+    }
+
+    // Cache full: keep the set we just built, flush, and start over with it
+    int *saved = (int *)malloc(sizeof(int) * (count + 1));
+    if (saved == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(saved, regex->work, sizeof(int) * count);
+    flushDfaCache(regex);
+    next = findOrAddDfaState(regex, saved, count);
+    free(saved);
+    return next;
+}
+
+// regexMatchesLine - Returns 1 if the regex matches anywhere in the line
+int regexMatchesLine(REGEX *regex, const unsigned char *line, long length) {
+    int state = regex->dfaStart;
+    if (regex->dfa[state].accepting) {
+        return 1;
+    }
+
+    for (long i = 0; i < length; i++) {
+        int byteClass = regex->byteClass[line[i]];
+        int next = regex->transitions[state * regex->classCount + byteClass];
+        if (next < 0) {
+            next = buildDfaTransition(regex, state, byteClass);
+        }
+        state = next;
+        if (regex->dfa[state].accepting) {
+            return 1;   // No need to look at the rest of the line
+        }
+        if (regex->dfa[state].nfaCount == 0) {
+            return 0;   // Dead state (only possible with ^): nothing can match now
+        }
+    }
+    return regex->dfa[state].acceptsAtEnd;
+}
+
+// =============================================================================
+// LENGTH HISTOGRAM FUNCTIONS
+// =============================================================================
+
+// printLengthHistogram - Prints how many words/lines there are of each length
+// Every non-empty bin is printed, shortest first. Power-of-two bins for very
+// long items are printed as a range, e.g. "Length: 256-511".
+void printLengthHistogram(FILE *outputFile, LENGTH_HISTOGRAM *histogram,
+                          const char *itemName, const char *pluralName) {
+    fprintf(outputFile, "%s Length Histogram:\n", itemName);
+    fprintf(outputFile, "Total Number of %s: %d\n", pluralName, histogram->total);
+    fprintf(outputFile, "Longest %s Length: %ld\n\n", itemName, histogram->maxLength);
+
+    for (int length = 0; length < HISTOGRAM_EXACT_LENGTHS; length++) {
+        if (histogram->exact[length] > 0) {
+            fprintf(outputFile, "Length: %d, Count: %d\n", length, histogram->exact[length]);
+        }
+    }
+    for (int bucket = 0; bucket < HISTOGRAM_LOG_BUCKETS; bucket++) {
+        if (histogram->logBuckets[bucket] > 0) {
+            unsigned long long low = 1ULL << bucket;
+            fprintf(outputFile, "Length: %llu-%llu, Count: %d\n",
+                   low, low * 2 - 1, histogram->logBuckets[bucket]);
+        }
+    }
+}
+
+// =============================================================================
+// UTF-8 CODE POINT FUNCTIONS
+// =============================================================================
+
+// decodeUtf8 - Decodes one multibyte UTF-8 sequence starting at bytes[0]
+// Follows the well-formed byte sequence table of the Unicode standard, so
+// overlong forms, surrogates (U+D800-DFFF) and values past U+10FFFF are all
+// rejected. Must not be called on an ASCII byte.
+// Parameters:
+//   bytes: Start of the sequence
+//   available: Bytes left in the buffer from bytes[0] on
+//   codePoint: Receives the decoded value when the sequence is valid
+// Returns: Length of the valid sequence (2-4), or minus the number of bytes
+//          that make up the invalid sequence (the maximal ill-formed prefix,
+//          always at least 1) so the caller can skip exactly that much
+int decodeUtf8(const unsigned char *bytes, long available, uint32_t *codePoint) {
+    unsigned char lead = bytes[0];
+    int length;
+    unsigned char low = 0x80;   // Allowed range for the second byte
+    unsigned char high = 0xBF;
+    uint32_t value;
+
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+        value = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        value = lead & 0x0F;
+        if (lead == 0xE0) {
+            low = 0xA0;    // Rules out overlong 3-byte forms
+        } else if (lead == 0xED) {
+            high = 0x9F;   // Rules out surrogates
+        }
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        value = lead & 0x07;
+        if (lead == 0xF0) {
+            low = 0x90;    // Rules out overlong 4-byte forms
+        } else if (lead == 0xF4) {
+            high = 0x8F;   // Rules out values past U+10FFFF
+        }
+    } else {
+        // Stray continuation byte, or C0/C1/F5-FF which never start a sequence
+        return -1;
+    }
+
+    for (int i = 1; i < length; i++) {
+        if (i >= available) {
+            return -i;     // Truncated at end of file
+        }
+        unsigned char next = bytes[i];
+        unsigned char min = (i == 1) ? low : 0x80;
+        unsigned char max = (i == 1) ? high : 0xBF;
+        if (next < min || next > max) {
+            return -i;     // Everything before this byte is the bad sequence
+        }
+        value = (value << 6) | (next & 0x3F);
+    }
+
+    *codePoint = value;
+    return length;
+}
+
+// addCodePoint - Counts one non-ASCII code point in the code point table
+// Open addressing with linear probing; the table doubles once it is half full
+void addCodePoint(CODE_POINT_STATS *stats, uint32_t value, int position) {
+    if ((stats->tableUsed + 1) * 2 > stats->tableSize) {
+        // Grow: rehash every entry into a table twice the size
+        int newSize = (stats->tableSize == 0) ? CODE_POINT_TABLE_START : stats->tableSize * 2;
+        CODE_POINT *newTable = (CODE_POINT *)trackedCalloc((size_t)newSize, sizeof(CODE_POINT),
+                                                           MEM_TABLES);
+        if (newTable == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+        for (int i = 0; i < stats->tableSize; i++) {
+            if (stats->table[i].value != 0) {
+                uint32_t slot = (stats->table[i].value * 2654435761u) & (uint32_t)(newSize - 1);
+                while (newTable[slot].value != 0) {
+                    slot = (slot + 1) & (uint32_t)(newSize - 1);
+                }
+                newTable[slot] = stats->table[i];
+            }
+        }
+        trackedFree(stats->table, sizeof(CODE_POINT) * (size_t)stats->tableSize, MEM_TABLES);
+        stats->table = newTable;
+        stats->tableSize = newSize;
+    }
+
+    uint32_t mask = (uint32_t)(stats->tableSize - 1);
+    uint32_t slot = (value * 2654435761u) & mask;
+    while (stats->table[slot].value != 0) {
+        if (stats->table[slot].value == value) {
+            stats->table[slot].frequency++;
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    // First time seeing this code point
+    stats->table[slot].value = value;
+    stats->table[slot].frequency = 1;
+    stats->table[slot].firstPos = position;
+    stats->tableUsed++;
+}
+
+// analyzeCodePoints - Counts every UTF-8 code point in the file
+// Text that is mostly ASCII is handled eight bytes at a time: one 64-bit test
+// tells whether any of the eight has its high bit set, and if none does they
+// all go straight into the ASCII histogram with no decoding. Only multibyte
+// sequences are validated and sent to the code point table. Each invalid
+// sequence counts as one position (like a U+FFFD replacement would) and is
+// tallied separately.
+// With -c as well, asciiCounts holds its per-byte counts. ASCII bytes are
+// never part of a multibyte or invalid sequence, so those are the ASCII
+// counts here too; only each character's first position (a code point
+// index, not a byte offset) is still looked for, and once all are found
+// ASCII runs are just skipped.
+void analyzeCodePoints(const unsigned char *data, long size, const int *asciiCounts,
+                       CODE_POINT_STATS *stats) {
+    const uint64_t highBits = 0x8080808080808080ULL;
+    long pos = 0;
+    int position = 0;   // Code point index
+    int asciiUnplaced = 0;   // With asciiCounts: characters whose first position isn't known yet
+
+    memset(stats, 0, sizeof(CODE_POINT_STATS));
+    stats->firstInvalidPos = -1;
+    if (asciiCounts != NULL) {
+        for (int i = 0; i < ASCII_RANGE; i++) {
+            stats->asciiFrequency[i] = asciiCounts[i];
+            stats->asciiFirstPos[i] = -1;
+            asciiUnplaced += (asciiCounts[i] > 0);
+        }
+    }
+
+    while (pos < size) {
+        // Fast path: eight ASCII bytes in a row
+        if (pos + 8 <= size) {
+            uint64_t block;
+            memcpy(&block, data + pos, sizeof(block));
+            if ((block & highBits) == 0) {
+                if (asciiCounts == NULL) {
+                    for (int i = 0; i < 8; i++) {
+                        int c = data[pos + i];
+                        if (stats->asciiFrequency[c] == 0) {
+                            stats->asciiFirstPos[c] = position + i;
+                        }
+                        stats->asciiFrequency[c]++;
+                    }
+                } else if (asciiUnplaced > 0) {
+                    for (int i = 0; i < 8; i++) {
+                        int c = data[pos + i];
+                        if (stats->asciiFirstPos[c] < 0) {
+                            stats->asciiFirstPos[c] = position + i;
+                            asciiUnplaced--;
+                        }
+                    }
+                }
+                pos += 8;
+                position += 8;
+                continue;
+            }
+        }
+
+        int c = data[pos];
+        if (c < 0x80) {
+            // Single ASCII byte (near a multibyte sequence or the end of file)
+            if (asciiCounts == NULL) {
+                if (stats->asciiFrequency[c] == 0) {
+                    stats->asciiFirstPos[c] = position;
+                }
+                stats->asciiFrequency[c]++;
+            } else if (stats->asciiFirstPos[c] < 0) {
+                stats->asciiFirstPos[c] = position;
+                asciiUnplaced--;
+            }
+            pos++;
+        } else {
+            uint32_t value = 0;
+            int length = decodeUtf8(data + pos, size - pos, &value);
+            if (length > 0) {
+                addCodePoint(stats, value, position);
+                pos += length;
+            } else {
+                if (stats->invalidCount == 0) {
+                    stats->firstInvalidPos = position;
+                }
+                stats->invalidCount++;
+                pos += -length;
+            }
+        }
+        position++;
+    }
+
+    stats->totalCodePoints = position;
+    if (asciiCounts != NULL) {
+        for (int i = 0; i < ASCII_RANGE; i++) {
+            if (stats->asciiFirstPos[i] < 0) {
+                stats->asciiFirstPos[i] = 0;   // Never seen, as without asciiCounts
+            }
+        }
+    }
+}
+
+// compareCodePoints - qsort comparator: ascending code point value
+int compareCodePoints(const void *a, const void *b) {
+    uint32_t valueA = ((const CODE_POINT *)a)->value;
+    uint32_t valueB = ((const CODE_POINT *)b)->value;
+    return (valueA > valueB) - (valueA < valueB);
+}
+
+// printCodePointAnalysis - Prints UTF-8 code point statistics
+// Code points are listed in ascending order, printed as U+XXXX followed by
+// the character itself (its original UTF-8 bytes). Invalid sequences are
+// reported on one final line of their own.
+void printCodePointAnalysis(FILE *outputFile, CODE_POINT_STATS *stats) {
+    int uniqueCount = stats->tableUsed;
+    for (int i = 0; i < ASCII_RANGE; i++) {
+        if (stats->asciiFrequency[i] > 0) {
+            uniqueCount++;
+        }
+    }
+
+    fprintf(outputFile, "Total Number of Code Points = %d\n", stats->totalCodePoints);
+    fprintf(outputFile, "Total Unique Code Points = %d\n", uniqueCount);
+    fprintf(outputFile, "Total Invalid Sequences = %d\n\n", stats->invalidCount);
+
+    // ASCII first (already in order)
+    for (int i = 0; i < ASCII_RANGE; i++) {
+        if (stats->asciiFrequency[i] > 0) {
+            fprintf(outputFile, "Code Point: U+%04X, Char: %c, Count: %d, Initial Position: %d\n",
+                   i, i, stats->asciiFrequency[i], stats->asciiFirstPos[i]);
+        }
+    }
+
+    // Then the multibyte code points, sorted by value
+    CODE_POINT *entries = (CODE_POINT *)trackedMalloc(sizeof(CODE_POINT) * (stats->tableUsed + 1),
+                                                      MEM_SORT);
+    if (entries == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+    int entryCount = 0;
+    for (int i = 0; i < stats->tableSize; i++) {
+        if (stats->table[i].value != 0) {
+            entries[entryCount++] = stats->table[i];
+        }
+    }
+    qsort(entries, entryCount, sizeof(CODE_POINT), compareCodePoints);
+
+    for (int i = 0; i < entryCount; i++) {
+        // Re-encode the code point as UTF-8 for display
+        uint32_t value = entries[i].value;
+        char encoded[5];
+        if (value < 0x800) {
+            encoded[0] = (char)(0xC0 | (value >> 6));
+            encoded[1] = (char)(0x80 | (value & 0x3F));
+            encoded[2] = '\0';
+        } else if (value < 0x10000) {
+            encoded[0] = (char)(0xE0 | (value >> 12));
+            encoded[1] = (char)(0x80 | ((value >> 6) & 0x3F));
+            encoded[2] = (char)(0x80 | (value & 0x3F));
+            encoded[3] = '\0';
+        } else {
+            encoded[0] = (char)(0xF0 | (value >> 18));
+            encoded[1] = (char)(0x80 | ((value >> 12) & 0x3F));
+            encoded[2] = (char)(0x80 | ((value >> 6) & 0x3F));
+            encoded[3] = (char)(0x80 | (value & 0x3F));
+            encoded[4] = '\0';
+        }
+        fprintf(outputFile, "Code Point: U+%04X, Char: %s, Count: %d, Initial Position: %d\n",
+               (unsigned int)value, encoded, entries[i].frequency, entries[i].firstPos);
+    }
+
+    if (stats->invalidCount > 0) {
+        fprintf(outputFile, "Invalid Sequences, Count: %d, Initial Position: %d\n",
+               stats->invalidCount, stats->firstInvalidPos);
+    }
+
+    trackedFree(entries, sizeof(CODE_POINT) * (stats->tableUsed + 1), MEM_SORT);
+}
+
+// =============================================================================
+// LONGEST WORD/LINE FUNCTIONS
+// =============================================================================
+
+// collectLongest - Gathers the entries of a word or line list that share
+// the greatest length, sorted alphabetically (they might not be
+// consecutive in the list, which needn't be alphabetical anyway)
+// Returns: Array of the entries (caller frees it); the length and number of
+//          entries go to *maxLength and *count
+WORD** collectLongest(WORD *head, int *maxLength, int *count) {
+    // Find the maximum length among all entries
+    int longest = 0;
+    for (WORD *current = head; current != NULL; current = current->nextWord) {
+        if (current->numChars > longest) {
+            longest = current->numChars;
+        }
+    }
+
+    // Collect all entries with maximum length
+    int longestCount = 0;
+    for (WORD *current = head; current != NULL; current = current->nextWord) {
+        longestCount += (current->numChars == longest);
+    }
+    WORD **entries = (WORD **)trackedMalloc(sizeof(WORD *) * (size_t)(longestCount + 1), MEM_SORT);
+    if (entries == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+
+    longestCount = 0;
+    for (WORD *current = head; current != NULL; current = current->nextWord) {
+        if (current->numChars == longest) {
+            entries[longestCount++] = current;
+        }
+    }
+    qsort(entries, (size_t)longestCount, sizeof(WORD *), compareWordNodes);
+
+    *maxLength = longest;
+    *count = longestCount;
+    return entries;
+}
+
+// printLongestWord - Finds and prints the longest word(s)
+void printLongestWord(FILE *outputFile, WORD *wordHead) {
+    if (wordHead == NULL) {
+        return;
+    }
+
+    int maxLength = 0;
+    int longestCount = 0;
+    WORD **longestWords = collectLongest(wordHead, &maxLength, &longestCount);
+
+    // Print the longest word(s)
+    fprintf(outputFile, "Longest Word is %d characters long:\n", maxLength);
+    for (int i = 0; i < longestCount; i++) {
+        printToken(outputFile, "\t", longestWords[i]->contents, longestWords[i]->numChars);
+        fputc('\n', outputFile);
+    }
+
+    trackedFree(longestWords, sizeof(WORD *) * (size_t)(longestCount + 1), MEM_SORT);
+}
+
+// printLongestLine - Finds and prints the longest line(s)
+void printLongestLine(FILE *outputFile, WORD *lineHead) {
+    if (lineHead == NULL) {
+        return;
+    }
+
+    int maxLength = 0;
+    int longestCount = 0;
+    WORD **longestLines = collectLongest(lineHead, &maxLength, &longestCount);
+
+    // Print the longest line(s)
+    fprintf(outputFile, "Longest Line is %d characters long:\n", maxLength);
+    for (int i = 0; i < longestCount; i++) {
+        printToken(outputFile, "\t", longestLines[i]->contents, longestLines[i]->numChars);
+        fputc('\n', outputFile);
+    }
+
+    trackedFree(longestLines, sizeof(WORD *) * (size_t)(longestCount + 1), MEM_SORT);
+}
+
+// readInputFile - Loads the whole input file into memory
+// Every analysis then works from this one copy instead of re-reading the file.
+// One extra byte is allocated past the end (set to '\0') so the last word or
+// line can be terminated in place.
+// Parameters:
+//   fileSize: The size found with ftell(); fileSize + 1 bytes are allocated
+//   bytesRead: Set to the bytes actually read, which is less if the file
+//              shrank in the meantime (the rest is then treated as absent)
+// Returns: The buffer (caller frees it, as fileSize + 1 bytes)
+char* readInputFile(FILE *fp, long fileSize, long *bytesRead) {
+    char *data = (char *)trackedMalloc((size_t)fileSize + 1, MEM_BUFFERS);
+    if (data == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+
+    size_t got = fread(data, 1, (size_t)fileSize, fp);
+    data[got] = '\0';
+    *bytesRead = (long)got;
+    return data;
+}
+
+// analyzeCharacters - Counts frequency and position of each character
+// Walks the in-memory file once and tracks:
+// - How many times each character appears
+// - The first position each character appears at
+// - (optional) How many times each adjacent byte pair appears, when
+//   pairFrequency is not NULL
+// The file is taken CHAR_BLOCK_SIZE bytes at a time: the characters in a
+// block are counted, then its pairs while it is still in cache, so memory
+// is read once for both.
+void analyzeCharacters(const unsigned char *data,
+                      long size,
+                      int charFrequency[],
+                      int charFirstPos[],
+                      int *uniqueCharCount,
+                      int pairFrequency[]) {
+    int byteFrequency[BYTE_RANGE];
+    int byteFirstPos[BYTE_RANGE];
+
+    // Initialize arrays to 0
+    // Bytes 128-255 are counted too so they never index past the end of an
+    // array, but only 0-127 are reported
+    for (int i = 0; i < BYTE_RANGE; i++) {
+        byteFrequency[i] = 0;
+        byteFirstPos[i] = 0;
+    }
+
+    // Pair counts go into PAIR_LANES interleaved sub-tables first (see
+    // countBytePairs), then get folded back into one count per pair
+    unsigned int *laneCounts = NULL;
+    if (pairFrequency != NULL) {
+        laneCounts = (unsigned int *)trackedCalloc((size_t)PAIR_RANGE * PAIR_LANES,
+                                                   sizeof(unsigned int), MEM_TABLES);
+        if (laneCounts == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+    }
+
+    for (long blockStart = 0; blockStart < size; blockStart += CHAR_BLOCK_SIZE) {
+        long blockEnd = (size - blockStart > CHAR_BLOCK_SIZE) ? blockStart + CHAR_BLOCK_SIZE : size;
+
+        // Go through the block character by character
+        for (long charPosition = blockStart; charPosition < blockEnd; charPosition++) {
+            int c = data[charPosition];
+            // For each character, increment its frequency
+            if (byteFrequency[c] == 0) {
+                // First time seeing this character
+                byteFirstPos[c] = (int)charPosition;
+            }
+            byteFrequency[c]++;
+        }
+
+        // Then every pair that starts in the block (the last one ends on
+        // the next block's first byte)
+        if (laneCounts != NULL) {
+            long pairEnd = (blockEnd < size) ? blockEnd + 1 : size;
+            countBytePairs(data + blockStart, (size_t)(pairEnd - blockStart), laneCounts);
+        }
+    }
+
+    // Copy the ASCII part out to the caller's arrays
+    *uniqueCharCount = 0;
+    for (int i = 0; i < ASCII_RANGE; i++) {
+        charFrequency[i] = byteFrequency[i];
+        charFirstPos[i] = byteFirstPos[i];
+        if (byteFrequency[i] > 0) {
+            *uniqueCharCount += 1;
+        }
+    }
+
+    // Fold the lanes back into one count per pair
+    if (laneCounts != NULL) {
+        for (int pair = 0; pair < PAIR_RANGE; pair++) {
+            unsigned int *lanes = &laneCounts[(size_t)pair * PAIR_LANES];
+            unsigned int sum = 0;
+            for (int lane = 0; lane < PAIR_LANES; lane++) {
+                sum += lanes[lane];
+            }
+            pairFrequency[pair] = (int)sum;
+        }
+        trackedFree(laneCounts, sizeof(unsigned int) * PAIR_RANGE * PAIR_LANES, MEM_TABLES);
+    }
+}
+
+// printCharacterAnalysis - Prints all character statistics
+void printCharacterAnalysis(FILE *outputFile,
+                           int charFrequency[],
+                           int charFirstPos[],
+                           int totalCharCount,
+                           int uniqueCharCount) {
+    fprintf(outputFile, "Total Number of Chars = %d\n", totalCharCount);
+    fprintf(outputFile, "Total Unique Chars = %d\n\n", uniqueCharCount);
+
+    // Loop through all ASCII values (0-127) and print if character appeared
+    for (int i = 0; i < ASCII_RANGE; i++) {
+        if (charFrequency[i] > 0) {
+            // Character appeared in file
+            fprintf(outputFile, "Ascii Value: %d, Char: %c, Count: %d, Initial Position: %d\n",
+                   i, i, charFrequency[i], charFirstPos[i]);
+        }
+    }
+}
+
+// =============================================================================
+// BYTE-PAIR ANALYSIS FUNCTIONS
+// =============================================================================
+
+// countBytePairs - Adds every adjacent byte pair in buffer to laneCounts
+// A pair is the 16-bit value (first << 8) | second. Runs of the same pair
+// (e.g. "    " or "====") would make every increment wait on the one before
+// it, so consecutive pairs rotate through PAIR_LANES sub-tables instead.
+// The sub-tables are interleaved ([pair][lane]) so all lanes of one pair sit
+// in the same cache line and merging them afterwards is a linear sweep.
+// Parameters:
+//   buffer, length: The bytes to count (one block of the file, plus the
+//                   next block's first byte)
+//   laneCounts: PAIR_RANGE * PAIR_LANES counters
+void countBytePairs(const unsigned char *buffer, size_t length, unsigned int *laneCounts) {
+    size_t i = 0;
+
+    // Main loop: four pairs per iteration, one per lane
+    for (; i + PAIR_LANES < length; i += PAIR_LANES) {
+        unsigned int p0 = ((unsigned int)buffer[i]     << 8) | buffer[i + 1];
+        unsigned int p1 = ((unsigned int)buffer[i + 1] << 8) | buffer[i + 2];
+        unsigned int p2 = ((unsigned int)buffer[i + 2] << 8) | buffer[i + 3];
+        unsigned int p3 = ((unsigned int)buffer[i + 3] << 8) | buffer[i + 4];
+        laneCounts[(size_t)p0 * PAIR_LANES + 0]++;
+        laneCounts[(size_t)p1 * PAIR_LANES + 1]++;
+        laneCounts[(size_t)p2 * PAIR_LANES + 2]++;
+        laneCounts[(size_t)p3 * PAIR_LANES + 3]++;
+    }
+
+    // Leftover pairs at the end of the buffer
+    for (; i + 1 < length; i++) {
+        unsigned int pair = ((unsigned int)buffer[i] << 8) | buffer[i + 1];
+        laneCounts[(size_t)pair * PAIR_LANES]++;
+    }
+}
+
+// Pair counts used by comparePairIndexes (qsort has no user pointer in C99)
+int *sortPairCounts = NULL;
+
+// comparePairIndexes - qsort comparator for --top: highest count first,
+// ties broken by pair value so the output is deterministic
+int comparePairIndexes(const void *a, const void *b) {
+    int pairA = *(const int *)a;
+    int pairB = *(const int *)b;
+    if (sortPairCounts[pairA] != sortPairCounts[pairB]) {
+        return (sortPairCounts[pairA] > sortPairCounts[pairB]) ? -1 : 1;
+    }
+    return pairA - pairB;
+}
+
+// printPairAnalysis - Prints byte-pair statistics
+// Only pairs that actually occur are printed. By default they are listed in
+// pair-value order (the same order -c uses for single characters); with
+// --top <n> only the n most frequent pairs are listed, most frequent first.
+void printPairAnalysis(FILE *outputFile, int pairFrequency[],
+                       int totalPairCount, int topCount) {
+    // Collect the pairs that occurred
+    int *pairs = (int *)trackedMalloc(sizeof(int) * PAIR_RANGE, MEM_SORT);
+    if (pairs == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+    int uniquePairCount = 0;
+    for (int pair = 0; pair < PAIR_RANGE; pair++) {
+        if (pairFrequency[pair] > 0) {
+            pairs[uniquePairCount++] = pair;
+        }
+    }
+
+    int printCount = uniquePairCount;
+    if (topCount > 0) {
+        sortPairCounts = pairFrequency;
+        qsort(pairs, uniquePairCount, sizeof(int), comparePairIndexes);
+        sortPairCounts = NULL;
+        if (topCount < printCount) {
+            printCount = topCount;
+        }
+    }
+
+    fprintf(outputFile, "Total Number of Char Pairs = %d\n", totalPairCount);
+    fprintf(outputFile, "Total Unique Char Pairs = %d\n\n", uniquePairCount);
+
+    for (int i = 0; i < printCount; i++) {
+        int first = pairs[i] >> 8;
+        int second = pairs[i] & 0xFF;
+        fprintf(outputFile, "Ascii Values: %d %d, Chars: %c%c, Count: %d\n",
+               first, second, first, second, pairFrequency[pairs[i]]);
+    }
+
+    trackedFree(pairs, sizeof(int) * PAIR_RANGE, MEM_SORT);
+}
+
+// isScanSection - Returns 1 for sections that come from the text scan
+// (word and line sections, as opposed to the whole-file character ones)
+int isScanSection(int flag) {
+    return flag == FLAG_W || flag == FLAG_L || flag == FLAG_LW ||
+           flag == FLAG_LL || flag == FLAG_HW || flag == FLAG_HL;
+}
+
+// printScanSection - Prints one word or line section from a scan's results
+// Returns: 1 if anything was printed
+int printScanSection(FILE *outputFile, int flag, TEXT_SCAN *scan) {
+    switch (flag) {
+        case FLAG_W:
+            if (scan->wordHead != NULL || scan->totalWords == 0) {
+                printWordAnalysis(outputFile, scan->wordHead, scan->totalWords, scan->uniqueWords);
+                return 1;
+            }
+            break;
+
+        case FLAG_L:
+            if (scan->lineHead != NULL || scan->totalLines == 0) {
+                printLineAnalysis(outputFile, scan->lineHead, scan->totalLines, scan->uniqueLines);
+                return 1;
+            }
+            break;
+
+        case FLAG_LW:
+            if (scan->wordHead != NULL) {
+                printLongestWord(outputFile, scan->wordHead);
+                return 1;
+            }
+            break;
+
+        case FLAG_LL:
+            if (scan->lineHead != NULL) {
+                printLongestLine(outputFile, scan->lineHead);
+                return 1;
+            }
+            break;
+
+        case FLAG_HW:
+            printLengthHistogram(outputFile, scan->wordLengths, "Word", "Words");
+            return 1;
+
+        case FLAG_HL:
+            printLengthHistogram(outputFile, scan->lineLengths, "Line", "Lines");
+            return 1;
+    }
+    return 0;
+}
+
+// =============================================================================
+// STRUCTURED OUTPUT FUNCTIONS
+// =============================================================================
+
+// initWriter - Sets up a buffered writer on an open file
+void initWriter(WRITER *writer, FILE *file) {
+    writer->file = file;
+    writer->used = 0;
+    writer->buffer = (char *)trackedMalloc(WRITER_BUFFER_SIZE, MEM_BUFFERS);
+    if (writer->buffer == NULL) {
+        printf("ERROR: Memory allocation failed\n");
+        exit(1);
+    }
+}
+
+// flushWriter - Hands everything buffered so far to the file
+void flushWriter(WRITER *writer) {
+    if (writer->used > 0) {
+        fwrite(writer->buffer, 1, writer->used, writer->file);
+        writer->used = 0;
+    }
+}
+
+// writeBytes - Appends bytes to the buffer, flushing it first if needed
+// (anything bigger than the whole buffer is written straight through)
+// data may be NULL when length is 0 (an empty string pool, say)
+void writeBytes(WRITER *writer, const char *data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (writer->used + length > WRITER_BUFFER_SIZE) {
+        flushWriter(writer);
+        if (length > WRITER_BUFFER_SIZE) {
+            fwrite(data, 1, length, writer->file);
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->used, data, length);
+    writer->used += length;
+}
+
+// writeText - Appends a '\0'-terminated string
+void writeText(WRITER *writer, const char *text) {
+    writeBytes(writer, text, strlen(text));
+}
+
+// writeInteger - Appends a number in decimal
+// The digits are produced right to left into a small array, with no format
+// string to interpret on every call
+void writeInteger(WRITER *writer, long long value) {
+    char digits[24];
+    int start = (int)sizeof(digits);
+    unsigned long long magnitude = (value < 0) ? 0ULL - (unsigned long long)value
+                                               : (unsigned long long)value;
+    do {
+        digits[--start] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        digits[--start] = '-';
+    }
+    writeBytes(writer, digits + start, sizeof(digits) - (size_t)start);
+}
+
+// blockMatchesByte - Checks 8 bytes at once for one byte value
+// The usual "has a zero byte" bit trick on the block XORed with the value
+// Returns: Nonzero (high bits set) if any of the 8 bytes equals value
+uint64_t blockMatchesByte(uint64_t block, unsigned char value) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t diff = block ^ (ones * value);
+    return (diff - ones) & ~diff & (ones * 0x80);
+}
+
+// blockNeedsEscape - Checks 8 bytes at once for anything a JSON string
+// can't hold as is: control characters (below 0x20), '"' and '\\'
+// (bytes from 0x80 up never match)
+int blockNeedsEscape(uint64_t block) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t control = (block - ones * 0x20) & ~block & (ones * 0x80);
+    return (control | blockMatchesByte(block, '"') | blockMatchesByte(block, '\\')) != 0;
+}
+
+// writeJsonString - Appends text as a quoted JSON string
+// Clean stretches are found 8 bytes at a time and copied in one piece; only
+// blocks that hold a byte needing an escape are looked at byte by byte.
+// Bytes from 0x80 up are copied unchanged (UTF-8 input stays UTF-8).
+void writeJsonString(WRITER *writer, const char *text, size_t length) {
+    static const char hexDigits[] = "0123456789abcdef";
+    writeBytes(writer, "\"", 1);
+
+    size_t runStart = 0;
+    size_t i = 0;
+    while (i < length) {
+        if (i + 8 <= length) {
+            uint64_t block;
+            memcpy(&block, text + i, 8);
+            if (!blockNeedsEscape(block)) {
+                i += 8;
+                continue;
+            }
+        }
+
+        unsigned char c = (unsigned char)text[i];
+        if (c < 0x20 || c == '"' || c == '\\') {
+            writeBytes(writer, text + runStart, i - runStart);
+            char escape[6] = {'\\', (char)c, 0, 0, 0, 0};
+            size_t escapeLength = 2;
+            if (c == '\n') {
+                escape[1] = 'n';
+            } else if (c == '\t') {
+                escape[1] = 't';
+            } else if (c == '\r') {
+                escape[1] = 'r';
+            } else if (c == '\b') {
+                escape[1] = 'b';
+            } else if (c == '\f') {
+                escape[1] = 'f';
+            } else if (c < 0x20) {
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hexDigits[c >> 4];
+                escape[5] = hexDigits[c & 0xF];
+                escapeLength = 6;
+            }
+            writeBytes(writer, escape, escapeLength);
+            runStart = i + 1;
+        }
+        i++;
+    }
+
+    writeBytes(writer, text + runStart, length - runStart);
+    writeBytes(writer, "\"", 1);
+}
+
+// fieldNeedsQuoting - Checks whether a CSV field has to be quoted (it holds
+// a comma, quote, CR or LF) or a TSV field needs escapes (tab, CR, LF or
+// backslash); 8 bytes at a time, then the leftover bytes one by one
+int fieldNeedsQuoting(const char *text, size_t length, int format) {
+    unsigned char first = (format == FORMAT_CSV) ? ',' : '\t';
+    unsigned char second = (format == FORMAT_CSV) ? '"' : '\\';
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t block;
+        memcpy(&block, text + i, 8);
+        if (blockMatchesByte(block, first) | blockMatchesByte(block, second) |
+            blockMatchesByte(block, '\n') | blockMatchesByte(block, '\r')) {
+            return 1;
+        }
+    }
+    for (; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == first || c == second || c == '\n' || c == '\r') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// writeDelimitedField - Appends one CSV or TSV field
+// Fields are copied as they are unless they need it: CSV then wraps the
+// field in quotes and doubles any quotes inside; TSV writes tab, CR, LF and
+// backslash as \t, \r, \n and \\ (the form PostgreSQL COPY and most
+// loaders read).
+void writeDelimitedField(WRITER *writer, const char *text, size_t length, int format) {
+    if (!fieldNeedsQuoting(text, length, format)) {
+        writeBytes(writer, text, length);
+        return;
+    }
+
+    if (format == FORMAT_CSV) {
+        writeBytes(writer, "\"", 1);
+    }
+    size_t runStart = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (format == FORMAT_CSV) {
+            if (c == '"') {
+                // Write up to and including the quote, and leave it as the
+                // start of the next run so it comes out twice
+                writeBytes(writer, text + runStart, i + 1 - runStart);
+                runStart = i;
+            }
+        } else if (c == '\t' || c == '\n' || c == '\r' || c == '\\') {
+            char escape[2] = {'\\', (char)c};
+            if (c == '\t') {
+                escape[1] = 't';
+            } else if (c == '\n') {
+                escape[1] = 'n';
+            } else if (c == '\r') {
+                escape[1] = 'r';
+            }
+            writeBytes(writer, text + runStart, i - runStart);
+            writeBytes(writer, escape, 2);
+            runStart = i + 1;
+        }
+    }
+    writeBytes(writer, text + runStart, length - runStart);
+    if (format == FORMAT_CSV) {
+        writeBytes(writer, "\"", 1);
+    }
+}
+
+// freeWriter - Flushes what is left and frees the buffer
+void freeWriter(WRITER *writer) {
+    flushWriter(writer);
+    trackedFree(writer->buffer, WRITER_BUFFER_SIZE, MEM_BUFFERS);
+    writer->buffer = NULL;
+}
+
+// recordSectionName - Name of a section in the structured formats
+const char* recordSectionName(int flag) {
+    switch (flag) {
+        case FLAG_C:  return "char";
+        case FLAG_W:  return "word";
+        case FLAG_L:  return "line";
+        case FLAG_LW: return "longest_word";
+        case FLAG_LL: return "longest_line";
+    }
+    return "unknown";
+}
+
+// beginRecords - Starts a --format report
+// JSON wraps everything in one object: {"file": ..., "sections": [...]}.
+// JSON Lines has no wrapper; every header and row is its own line. CSV and
+// TSV start with a column header and then have one row per entry, with the
+// section name in the first column. The bin layout is described at
+// writeResultSection(), the Arrow stream at writeArrowStart().
+void beginRecords(RECORD_OUTPUT *out, FILE *file, int format, const char *inputFile) {
+    memset(out, 0, sizeof(RECORD_OUTPUT));
+    initWriter(&out->writer, file);
+    out->format = format;
+
+    if (format == FORMAT_BIN) {
+        writeResultBytes(out, RESULT_FILE_MAGIC, 8);
+        writeResultNumber(out, RESULT_FILE_VERSION, 4);
+        writeResultNumber(out, 0, 4);
+    } else if (format == FORMAT_ARROW) {
+        writeArrowStart(out);
+    } else if (format == FORMAT_JSON) {
+        writeText(&out->writer, "{\"file\":");
+        writeJsonString(&out->writer, inputFile, strlen(inputFile));
+        writeText(&out->writer, ",\"sections\":[");
+    } else if (format == FORMAT_CSV) {
+        writeText(&out->writer, "section,item,count,position,length\n");
+    } else if (format == FORMAT_TSV) {
+        writeText(&out->writer, "section\titem\tcount\tposition\tlength\n");
+    }
+}
+
+// beginRecordSection - Writes a section header (CSV and TSV have none: a
+// section's totals are its row count and the sum of its counts)
+// Parameters:
+//   flag: Which section (FLAG_C, FLAG_W, FLAG_L, FLAG_LW or FLAG_LL)
+//   firstKey/firstValue, secondKey/secondValue: The section's summary
+//       numbers, e.g. "total" and "unique"
+void beginRecordSection(RECORD_OUTPUT *out, int flag,
+                        const char *firstKey, long long firstValue,
+                        const char *secondKey, long long secondValue) {
+    WRITER *writer = &out->writer;
+    const char *section = recordSectionName(flag);
+    out->sectionFlag = flag;
+    out->section = section;
+    out->summary[0] = firstValue;
+    out->summary[1] = secondValue;
+    out->rowCount = 0;
+    out->poolUsed = 0;
+    out->sectionCount++;
+    if (out->format == FORMAT_CSV || out->format == FORMAT_TSV ||
+        out->format == FORMAT_BIN || out->format == FORMAT_ARROW) {
+        return;
+    }
+
+    if (out->format == FORMAT_JSON && out->sectionCount > 1) {
+        writeBytes(writer, ",", 1);
+    }
+    writeText(writer, (out->format == FORMAT_JSON) ? "\n{\"section\":\"" : "{\"section\":\"");
+    writeText(writer, section);
+    writeText(writer, "\",\"");
+    writeText(writer, firstKey);
+    writeText(writer, "\":");
+    writeInteger(writer, firstValue);
+    writeText(writer, ",\"");
+    writeText(writer, secondKey);
+    writeText(writer, "\":");
+    writeInteger(writer, secondValue);
+    writeText(writer, (out->format == FORMAT_JSON) ? ",\"entries\":[" : "}\n");
+}
+
+// writeRecordRow - Writes one entry of the current section
+void writeRecordRow(RECORD_OUTPUT *out, const char *item, size_t itemLength,
+                    long long count, long long position, long long length) {
+    WRITER *writer = &out->writer;
+    if (out->format == FORMAT_BIN) {
+        addResultRow(out, item, itemLength, count, position, length);
+        return;
+    }
+    if (out->format == FORMAT_ARROW) {
+        // Arrow strings use 32-bit offsets, and batches are kept to a
+        // bounded size so big listings stream out as they are written
+        if (out->rowCount == ARROW_BATCH_ROWS ||
+            out->poolUsed + itemLength > (size_t)INT32_MAX) {
+            writeArrowBatch(out);
+        }
+        addResultRow(out, item, itemLength, count, position, length);
+        return;
+    }
+
+    out->rowCount++;
+    if (out->format == FORMAT_CSV || out->format == FORMAT_TSV) {
+        char separator = (out->format == FORMAT_CSV) ? ',' : '\t';
+        writeText(writer, out->section);
+        writeBytes(writer, &separator, 1);
+        writeDelimitedField(writer, item, itemLength, out->format);
+        writeBytes(writer, &separator, 1);
+        writeInteger(writer, count);
+        writeBytes(writer, &separator, 1);
+        writeInteger(writer, position);
+        writeBytes(writer, &separator, 1);
+        writeInteger(writer, length);
+        writeBytes(writer, "\n", 1);
+        return;
+    }
+
+    if (out->format == FORMAT_JSON) {
+        writeText(writer, (out->rowCount > 1) ? ",\n{\"item\":" : "\n{\"item\":");
+    } else {
+        writeText(writer, "{\"section\":\"");
+        writeText(writer, out->section);
+        writeText(writer, "\",\"item\":");
+    }
+    writeJsonString(writer, item, itemLength);
+    writeText(writer, ",\"count\":");
+    writeInteger(writer, count);
+    writeText(writer, ",\"position\":");
+    writeInteger(writer, position);
+    writeText(writer, ",\"length\":");
+    writeInteger(writer, length);
+    writeText(writer, (out->format == FORMAT_JSON) ? "}" : "}\n");
+}
+
+// endRecordSection - Closes the current section
+void endRecordSection(RECORD_OUTPUT *out) {
+    if (out->format == FORMAT_JSON) {
+        writeText(&out->writer, "]}");
+    } else if (out->format == FORMAT_BIN) {
+        writeResultSection(out);
+    } else if (out->format == FORMAT_ARROW && out->rowCount > 0) {
+        writeArrowBatch(out);
+    }
+    out->section = NULL;
+}
+
+// endRecords - Finishes the report and flushes it
+void endRecords(RECORD_OUTPUT *out) {
+    if (out->format == FORMAT_JSON) {
+        writeText(&out->writer, "\n]}\n");
+    } else if (out->format == FORMAT_BIN) {
+        // Trailer: the section count, then the CRC-32 of everything before it
+        writeResultNumber(out, (uint64_t)out->sectionCount, 4);
+        uint32_t checksum = out->checksum;
+        writeResultNumber(out, checksum, 4);
+    } else if (out->format == FORMAT_ARROW) {
+        // End-of-stream marker: continuation token and a zero length
+        writeResultNumber(out, 0xFFFFFFFFU, 4);
+        writeResultNumber(out, 0, 4);
+    }
+    freeWriter(&out->writer);
+    trackedFree(out->counts, sizeof(uint32_t) * (size_t)out->rowCapacity, MEM_BUFFERS);
+    trackedFree(out->positions, sizeof(uint32_t) * (size_t)out->rowCapacity, MEM_BUFFERS);
+    trackedFree(out->lengths, sizeof(uint32_t) * (size_t)out->rowCapacity, MEM_BUFFERS);
+    trackedFree(out->pool, out->poolCapacity, MEM_BUFFERS);
+}
+
+// writeCharRecords - The -c section: one row per character that appears
+void writeCharRecords(RECORD_OUTPUT *out, int charFrequency[], int charFirstPos[],
+                      int totalCharCount, int uniqueCharCount) {
+    beginRecordSection(out, FLAG_C, "total", totalCharCount, "unique", uniqueCharCount);
+    for (int i = 0; i < ASCII_RANGE; i++) {
+        if (charFrequency[i] > 0) {
+            char item = (char)i;
+            writeRecordRow(out, &item, 1, charFrequency[i], charFirstPos[i], 1);
+        }
+    }
+    endRecordSection(out);
+}
+
+// writeListRecords - The -w or -l section: one row per unique entry, in
+// list order
+void writeListRecords(RECORD_OUTPUT *out, int flag, WORD *head, int total, int unique) {
+    beginRecordSection(out, flag, "total", total, "unique", unique);
+    for (WORD *current = head; current != NULL; current = current->nextWord) {
+        writeRecordRow(out, current->contents, (size_t)current->numChars,
+                       current->frequency, current->orderAppeared, current->numChars);
+    }
+    endRecordSection(out);
+}
+
+// writeLongestRecords - The -Lw or -Ll section: the longest entries,
+// alphabetically
+void writeLongestRecords(RECORD_OUTPUT *out, int flag, WORD *head) {
+    int maxLength = 0;
+    int longestCount = 0;
+    WORD **longest = collectLongest(head, &maxLength, &longestCount);
+
+    beginRecordSection(out, flag, "length", maxLength, "total", longestCount);
+    for (int i = 0; i < longestCount; i++) {
+        writeRecordRow(out, longest[i]->contents, (size_t)longest[i]->numChars,
+                       longest[i]->frequency, longest[i]->orderAppeared,
+                       longest[i]->numChars);
+    }
+    endRecordSection(out);
+
+    trackedFree(longest, sizeof(WORD *) * (size_t)(longestCount + 1), MEM_SORT);
+}
+
+// writeStructuredReport - Writes the requested sections in --format form,
+// in the order the flags appeared (the same sections the text report has)
+void writeStructuredReport(FILE *outputFile, OPTIONS *options, int format,
+                           int charFrequency[], int charFirstPos[], int totalCharCount,
+                           int uniqueCharCount, TEXT_SCAN *scan) {
+    RECORD_OUTPUT out;
+    beginRecords(&out, outputFile, format, options->inputFile);
+
+    for (int i = 0; i < options->flagCount; i++) {
+        switch (options->flagOrder[i]) {
+            case FLAG_C:
+                writeCharRecords(&out, charFrequency, charFirstPos,
+                                 totalCharCount, uniqueCharCount);
+                break;
+
+            case FLAG_W:
+                if (scan->wordHead != NULL || scan->totalWords == 0) {
+                    writeListRecords(&out, FLAG_W, scan->wordHead,
+                                     scan->totalWords, scan->uniqueWords);
+                }
+                break;
+
+            case FLAG_L:
+                if (scan->lineHead != NULL || scan->totalLines == 0) {
+                    writeListRecords(&out, FLAG_L, scan->lineHead,
+                                     scan->totalLines, scan->uniqueLines);
+                }
+                break;
+
+            case FLAG_LW:
+                if (scan->wordHead != NULL) {
+                    writeLongestRecords(&out, FLAG_LW, scan->wordHead);
+                }
+                break;
+
+            case FLAG_LL:
+                if (scan->lineHead != NULL) {
+                    writeLongestRecords(&out, FLAG_LL, scan->lineHead);
+                }
+                break;
+        }
+    }
+
+    endRecords(&out);
+}
+
+// =============================================================================
+// RESULT FILE FUNCTIONS
+// =============================================================================
+
+// CRC-32 lookup table, filled in on first use
+uint32_t crcTable[BYTE_RANGE];
+int crcTableReady = 0;
+
+// updateCrc32 - Continues a CRC-32 (the zlib/PNG polynomial) over more bytes
+// Start with crc = 0; the result of one call is the crc for the next
+uint32_t updateCrc32(uint32_t crc, const void *data, size_t length) {
+    if (!crcTableReady) {
+        for (uint32_t i = 0; i < BYTE_RANGE; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? (0xEDB88320U ^ (value >> 1)) : (value >> 1);
+            }
+            crcTable[i] = value;
+        }
+        crcTableReady = 1;
+    }
+
+    const unsigned char *bytes = (const unsigned char *)data;
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// writeResultBytes - Writes bytes to a --format bin file, adding them to
+// its checksum
+void writeResultBytes(RECORD_OUTPUT *out, const void *data, size_t length) {
+    if (length == 0) {
+        return;   // Nothing to add (data may be NULL)
+    }
+    if (out->format == FORMAT_BIN) {
+        out->checksum = updateCrc32(out->checksum, data, length);
+    }
+    writeBytes(&out->writer, (const char *)data, length);
+}
+
+// writeResultNumber - Writes the low bytes of value, least significant first
+void writeResultNumber(RECORD_OUTPUT *out, uint64_t value, int bytes) {
+    unsigned char buffer[8];
+    for (int i = 0; i < bytes; i++) {
+        buffer[i] = (unsigned char)((value >> (8 * i)) & 0xFF);
+    }
+    writeResultBytes(out, buffer, (size_t)bytes);
+}
+
+// writeResultColumn - Writes an array of u32 values, little-endian, a
+// chunk at a time (also used for the --format arrow column buffers)
+void writeResultColumn(RECORD_OUTPUT *out, const uint32_t *values, long count) {
+    unsigned char chunk[4096];
+    long i = 0;
+    while (i < count) {
+        size_t used = 0;
+        for (; i < count && used < sizeof(chunk); i++) {
+            chunk[used++] = (unsigned char)(values[i] & 0xFF);
+            chunk[used++] = (unsigned char)((values[i] >> 8) & 0xFF);
+            chunk[used++] = (unsigned char)((values[i] >> 16) & 0xFF);
+            chunk[used++] = (unsigned char)(values[i] >> 24);
+        }
+        writeResultBytes(out, chunk, used);
+    }
+}
+
+// addResultRow - Adds one row to the section's columns and string pool
+void addResultRow(RECORD_OUTPUT *out, const char *item, size_t itemLength,
+                  long long count, long long position, long long length) {
+    if (out->rowCount == out->rowCapacity) {
+        long newCapacity = (out->rowCapacity == 0) ? 1024 : out->rowCapacity * 2;
+        size_t oldBytes = sizeof(uint32_t) * (size_t)out->rowCapacity;
+        size_t newBytes = sizeof(uint32_t) * (size_t)newCapacity;
+        uint32_t *counts = (uint32_t *)trackedRealloc(out->counts, oldBytes, newBytes, MEM_BUFFERS);
+        if (counts != NULL) {
+            out->counts = counts;
+        }
+        uint32_t *positions = (uint32_t *)trackedRealloc(out->positions, oldBytes, newBytes,
+                                                         MEM_BUFFERS);
+        if (positions != NULL) {
+            out->positions = positions;
+        }
+        uint32_t *lengths = (uint32_t *)trackedRealloc(out->lengths, oldBytes, newBytes, MEM_BUFFERS);
+        if (lengths != NULL) {
+            out->lengths = lengths;
+        }
+        if (counts == NULL || positions == NULL || lengths == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+        out->rowCapacity = newCapacity;
+    }
+    if (out->poolUsed + itemLength > out->poolCapacity) {
+        size_t newCapacity = (out->poolCapacity == 0) ? 16384 : out->poolCapacity * 2;
+        while (newCapacity < out->poolUsed + itemLength) {
+            newCapacity *= 2;
+        }
+        char *pool = (char *)trackedRealloc(out->pool, out->poolCapacity, newCapacity, MEM_BUFFERS);
+        if (pool == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+        out->pool = pool;
+        out->poolCapacity = newCapacity;
+    }
+
+    out->counts[out->rowCount] = (uint32_t)count;
+    out->positions[out->rowCount] = (uint32_t)position;
+    out->lengths[out->rowCount] = (uint32_t)length;
+    if (itemLength > 0) {
+        memcpy(out->pool + out->poolUsed, item, itemLength);   // The pool is NULL until then
+        out->poolUsed += itemLength;
+    }
+    out->rowCount++;
+}
+
+// writeResultSection - Writes the finished section of a --format bin file
+// File layout (all integers little-endian):
+//   Header (16 bytes): "MADRES01", u32 version, u32 reserved
+//   Each section: a 32-byte header - u32 section (FLAG_C, FLAG_W, FLAG_L,
+//     FLAG_LW or FLAG_LL), u32 row count, u64 and u64 summary numbers
+//     (total and unique; length and total for -Lw/-Ll), u64 string pool
+//     bytes - then the count, position and length columns (u32 per row
+//     each), then the string pool (the items back to back) padded with
+//     zeros to a multiple of 8 bytes
+//   Trailer (8 bytes): u32 section count, u32 CRC-32 of everything before it
+// An item's length is its byte count in the pool, so the pool offsets are
+// the running sum of the length column.
+void writeResultSection(RECORD_OUTPUT *out) {
+    static const char padding[8] = {0};
+
+    writeResultNumber(out, (uint64_t)out->sectionFlag, 4);
+    writeResultNumber(out, (uint64_t)out->rowCount, 4);
+    writeResultNumber(out, (uint64_t)out->summary[0], 8);
+    writeResultNumber(out, (uint64_t)out->summary[1], 8);
+    writeResultNumber(out, (uint64_t)out->poolUsed, 8);
+
+    writeResultColumn(out, out->counts, out->rowCount);
+    writeResultColumn(out, out->positions, out->rowCount);
+    writeResultColumn(out, out->lengths, out->rowCount);
+    writeResultBytes(out, out->pool, out->poolUsed);
+    writeResultBytes(out, padding, (8 - out->poolUsed % 8) % 8);
+}
+
+// readLittleEndian - Reads a little-endian integer of the given size
+uint64_t readLittleEndian(const unsigned char *bytes, int count) {
+    uint64_t value = 0;
+    for (int i = count - 1; i >= 0; i--) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+// renderResultFile - Prints a --format bin file in the text report layout
+// Everything is checked before anything is printed: the magic, version and
+// checksum, and that every section fits in the file.
+// Returns: 1 on success, 0 if the file is not a valid result file
+int renderResultFile(FILE *outputFile, const unsigned char *data, size_t size) {
+    if (size < RESULT_HEADER_SIZE + RESULT_TRAILER_SIZE ||
+        memcmp(data, RESULT_FILE_MAGIC, 8) != 0 ||
+        readLittleEndian(data + 8, 4) != RESULT_FILE_VERSION ||
+        readLittleEndian(data + size - 4, 4) != updateCrc32(0, data, size - 4)) {
+        return 0;
+    }
+
+    // Walk the sections once to check their sizes
+    uint64_t sectionCount = readLittleEndian(data + size - RESULT_TRAILER_SIZE, 4);
+    size_t end = size - RESULT_TRAILER_SIZE;
+    size_t offset = RESULT_HEADER_SIZE;
+    for (uint64_t i = 0; i < sectionCount; i++) {
+        if (end - offset < RESULT_SECTION_SIZE) {
+            return 0;
+        }
+        uint64_t flag = readLittleEndian(data + offset, 4);
+        uint64_t rows = readLittleEndian(data + offset + 4, 4);
+        uint64_t poolBytes = readLittleEndian(data + offset + 24, 8);
+        offset += RESULT_SECTION_SIZE;
+        if (flag > FLAG_LL || rows * 12 > end - offset ||
+            poolBytes > end - offset - rows * 12) {
+            return 0;
+        }
+
+        const unsigned char *lengths = data + offset + rows * 8;
+        uint64_t lengthSum = 0;
+        for (uint64_t row = 0; row < rows; row++) {
+            lengthSum += readLittleEndian(lengths + row * 4, 4);
+        }
+        uint64_t paddedPool = poolBytes + (8 - poolBytes % 8) % 8;
+        if (lengthSum != poolBytes || paddedPool > end - offset - rows * 12) {
+            return 0;
+        }
+        offset += rows * 12 + paddedPool;
+    }
+    if (offset != end) {
+        return 0;
+    }
+
+    // Print the sections, one blank line between them as in the text report
+    offset = RESULT_HEADER_SIZE;
+    for (uint64_t i = 0; i < sectionCount; i++) {
+        int flag = (int)readLittleEndian(data + offset, 4);
+        uint64_t rows = readLittleEndian(data + offset + 4, 4);
+        long long firstValue = (long long)readLittleEndian(data + offset + 8, 8);
+        long long secondValue = (long long)readLittleEndian(data + offset + 16, 8);
+        uint64_t poolBytes = readLittleEndian(data + offset + 24, 8);
+        offset += RESULT_SECTION_SIZE;
+        const unsigned char *counts = data + offset;
+        const unsigned char *positions = counts + rows * 4;
+        const unsigned char *lengths = positions + rows * 4;
+        const char *item = (const char *)(lengths + rows * 4);
+
+        if (i > 0) {
+            fprintf(outputFile, "\n");
+        }
+        if (flag == FLAG_C) {
+            fprintf(outputFile, "Total Number of Chars = %lld\n", firstValue);
+            fprintf(outputFile, "Total Unique Chars = %lld\n\n", secondValue);
+        } else if (flag == FLAG_W || flag == FLAG_L) {
+            const char *name = (flag == FLAG_W) ? "Word" : "Line";
+            fprintf(outputFile, "Total Number of %ss: %lld\n", name, firstValue);
+            fprintf(outputFile, "Total Unique %ss: %lld\n\n", name, secondValue);
+        } else {
+            fprintf(outputFile, "Longest %s is %lld characters long:\n",
+                    (flag == FLAG_LW) ? "Word" : "Line", firstValue);
+        }
+
+        for (uint64_t row = 0; row < rows; row++) {
+            unsigned int count = (unsigned int)readLittleEndian(counts + row * 4, 4);
+            unsigned int position = (unsigned int)readLittleEndian(positions + row * 4, 4);
+            int length = (int)readLittleEndian(lengths + row * 4, 4);
+            if (flag == FLAG_C) {
+                int value = (length > 0) ? (unsigned char)item[0] : 0;
+                fprintf(outputFile, "Ascii Value: %d, Char: %c, Count: %u, Initial Position: %u\n",
+                        value, value, count, position);
+            } else if (flag == FLAG_W || flag == FLAG_L) {
+                printToken(outputFile, (flag == FLAG_W) ? "Word: " : "Line: ", item, length);
+                fprintf(outputFile, ", Freq: %u, Initial Position: %u\n", count, position);
+            } else {
+                printToken(outputFile, "\t", item, length);
+                fputc('\n', outputFile);
+            }
+            item += length;
+        }
+        offset += rows * 12 + poolBytes + (8 - poolBytes % 8) % 8;
+    }
+    return 1;
+}
+
+// dumpResultFile - Handles --dump: reads a --format bin file and prints it
+// (to the -o file if one was given) as the text report it came from
+// Returns: 1 on success, 0 on error (error message already printed)
+int dumpResultFile(const char *filename, const char *outputFilename) {
+    FILE *inputFP = fopen(filename, "rb");
+    if (inputFP == NULL) {
+        printDumpFileError();
+        return 0;
+    }
+    fseek(inputFP, 0, SEEK_END);
+    long fileSize = ftell(inputFP);
+    fseek(inputFP, 0, SEEK_SET);
+    if (fileSize <= 0) {
+        printInvalidResultFileError();
+        fclose(inputFP);
+        return 0;
+    }
+    long length = 0;
+    char *data = readInputFile(inputFP, fileSize, &length);
+    fclose(inputFP);
+
+    FILE *outputFP = stdout;
+    if (outputFilename != NULL) {
+        outputFP = fopen(outputFilename, "w");
+        if (outputFP == NULL) {
+            printf("ERROR: Can't open output file\n");
+            trackedFree(data, (size_t)fileSize + 1, MEM_BUFFERS);
+            return 0;
+        }
+    }
+
+    int valid = renderResultFile(outputFP, (const unsigned char *)data, (size_t)length);
+    if (!valid) {
+        printInvalidResultFileError();
+    }
+
+    trackedFree(data, (size_t)fileSize + 1, MEM_BUFFERS);
+    if (outputFilename != NULL) {
+        fclose(outputFP);
+    }
+    return valid;
+}
+
+// =============================================================================
+// OUTPUT FILE FUNCTIONS
+// =============================================================================
+
+// openOutputFile - Opens the -o file for writing
+// With --compress, the compressor (pigz or gzip, or zstd, from the PATH)
+// is started as a child process with the file as its output, and the
+// stream returned feeds its input through a pipe. Compression then runs
+// alongside the printing instead of after it, and no compression library
+// is needed.
+// Parameters:
+//   compressor: Set to the compressor's process ID (0 without --compress)
+// Returns: The stream to print to, or NULL if the file can't be opened (or
+//          the compressor can't be started: *compressor is then -1)
+FILE* openOutputFile(const char *filename, int compress, pid_t *compressor) {
+    *compressor = 0;
+    if (compress == COMPRESS_NONE) {
+        return fopen(filename, "w");
+    }
+
+    int fileFd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fileFd < 0) {
+        return NULL;
+    }
+
+    // dataPipe carries the report; statusPipe only reports a failed exec
+    // (it is closed on a successful exec, so the parent reads end-of-file)
+    int dataPipe[2];
+    int statusPipe[2];
+    if (pipe(dataPipe) != 0) {
+        close(fileFd);
+        unlink(filename);
+        *compressor = -1;
+        return NULL;
+    }
+    if (pipe(statusPipe) != 0) {
+        close(dataPipe[0]);
+        close(dataPipe[1]);
+        close(fileFd);
+        unlink(filename);
+        *compressor = -1;
+        return NULL;
+    }
+    fcntl(statusPipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(dataPipe[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Child: stdin from the pipe, stdout to the file, then become the
+        // compressor
+        dup2(dataPipe[0], STDIN_FILENO);
+        dup2(fileFd, STDOUT_FILENO);
+        close(dataPipe[0]);
+        close(fileFd);
+        close(statusPipe[0]);
+        if (compress == COMPRESS_GZIP) {
+            // pigz writes the same format using every core; fast level,
+            // so compressing keeps up with printing
+            execlp("pigz", "pigz", "-1", "-c", (char *)NULL);
+            execlp("gzip", "gzip", "-1", "-c", (char *)NULL);
+        } else {
+            execlp("zstd", "zstd", "-q", "-c", (char *)NULL);
+        }
+        int error = errno;
+        ssize_t ignored = write(statusPipe[1], &error, sizeof(error));
+        (void)ignored;
+        _exit(127);
+    }
+
+    close(dataPipe[0]);
+    close(fileFd);
+    close(statusPipe[1]);
+    int error = 0;
+    ssize_t got = (pid > 0) ? read(statusPipe[0], &error, sizeof(error)) : 0;
+    close(statusPipe[0]);
+    if (pid < 0 || got > 0) {
+        close(dataPipe[1]);
+        if (pid > 0) {
+            waitpid(pid, NULL, 0);
+        }
+        unlink(filename);   // Don't leave an empty file behind
+        *compressor = -1;
+        return NULL;
+    }
+
+    FILE *fp = fdopen(dataPipe[1], "w");
+    if (fp == NULL) {
+        close(dataPipe[1]);
+        waitpid(pid, NULL, 0);
+        unlink(filename);
+        *compressor = -1;
+        return NULL;
+    }
+    *compressor = pid;
+    return fp;
+}
+
+// closeOutputFile - Closes a stream from openOutputFile() and, with
+// --compress, waits for the compressor to finish the file
+// Returns: 1 if everything was written, 0 if not
+int closeOutputFile(FILE *fp, pid_t compressor) {
+    int written = (fclose(fp) == 0);
+    if (compressor > 0) {
+        int status = 0;
+        if (waitpid(compressor, &status, 0) < 0 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            written = 0;
+        }
+    }
+    return written;
+}
+
+// collectOutputTargets - Lists the reports a command writes: each -o
+// fmt:path, or else the one --format report to the -o file or stdout
+// Returns: Number of targets filled in
+int collectOutputTargets(OPTIONS *options, OUTPUT_TARGET targets[]) {
+    memset(targets, 0, sizeof(OUTPUT_TARGET) * MAX_OUTPUT_TARGETS);
+    if (options->targetCount == 0) {
+        targets[0].format = options->format;
+        targets[0].path = options->outputFile;
+        return 1;
+    }
+    for (int i = 0; i < options->targetCount; i++) {
+        targets[i].format = options->targetFormats[i];
+        targets[i].path = options->targetFiles[i];
+    }
+    return options->targetCount;
+}
+
+// openOutputTargets - Opens every target's file (stdout if it has none)
+// Returns: 1 if all are open, 0 if one failed (error printed, the others
+//          closed again)
+int openOutputTargets(OUTPUT_TARGET targets[], int count, int compress) {
+    for (int i = 0; i < count; i++) {
+        targets[i].fp = stdout;
+        targets[i].compressor = 0;
+        if (targets[i].path == NULL) {
+            continue;
+        }
+        targets[i].fp = openOutputFile(targets[i].path, compress, &targets[i].compressor);
+        if (targets[i].fp == NULL) {
+            if (targets[i].compressor < 0) {
+                printCompressorError();
+            } else {
+                printf("ERROR: Can't open output file\n");
+            }
+            closeOutputTargets(targets, i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// closeOutputTargets - Closes the targets opened by openOutputTargets()
+// Returns: 1 if every file was written, 0 if not
+int closeOutputTargets(OUTPUT_TARGET targets[], int count) {
+    int written = 1;
+    for (int i = 0; i < count; i++) {
+        if (targets[i].path != NULL && !closeOutputFile(targets[i].fp, targets[i].compressor)) {
+            written = 0;
+        }
+    }
+    return written;
+}
+
+// =============================================================================
+// ARROW OUTPUT FUNCTIONS
+// =============================================================================
+
+// fbAppend - Appends bytes (zeros if bytes is NULL) after padding the
+// flatbuffer with zeros to the given alignment
+// Returns: Position of the appended bytes
+size_t fbAppend(FLATBUFFER *fb, const void *bytes, size_t length, size_t alignment) {
+    size_t padding = (alignment - fb->used % alignment) % alignment;
+    if (fb->used + padding + length > fb->capacity) {
+        size_t newCapacity = (fb->capacity == 0) ? 1024 : fb->capacity * 2;
+        while (newCapacity < fb->used + padding + length) {
+            newCapacity *= 2;
+        }
+        unsigned char *data = (unsigned char *)realloc(fb->data, newCapacity);
+        if (data == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
+        fb->data = data;
+        fb->capacity = newCapacity;
+    }
+
+    memset(fb->data + fb->used, 0, padding);
+    fb->used += padding;
+    size_t position = fb->used;
+    if (bytes != NULL) {
+        memcpy(fb->data + position, bytes, length);
+    } else {
+        memset(fb->data + position, 0, length);
+    }
+    fb->used += length;
+    return position;
+}
+
+// fbPutNumber - Stores a little-endian number at a position already in
+// the flatbuffer
+void fbPutNumber(FLATBUFFER *fb, size_t position, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fb->data[position + i] = (unsigned char)((value >> (8 * i)) & 0xFF);
+    }
+}
+
+// fbPatch - Points an offset field (or vector element) at an object placed
+// after it
+void fbPatch(FLATBUFFER *fb, size_t fieldPosition, size_t target) {
+    fbPutNumber(fb, fieldPosition, (uint64_t)(target - fieldPosition), 4);
+}
+
+// fbTable - Appends a table: its vtable, then the table itself
+// Fields are laid out largest first after the table's 4-byte vtable offset,
+// each aligned to its size (the table starts on an 8-byte boundary). Offset
+// fields get a placeholder; patch them with fbPatch(fields[i].position, ...)
+// once their target has been appended.
+// Returns: Position of the table
+size_t fbTable(FLATBUFFER *fb, FB_FIELD fields[], int count) {
+    size_t fieldOffsets[FB_MAX_FIELDS];
+    size_t tableSize = 4;
+    for (int size = 8; size >= 1; size /= 2) {
+        for (int i = 0; i < count; i++) {
+            if (fields[i].size == size) {
+                tableSize = (tableSize + (size_t)size - 1) / (size_t)size * (size_t)size;
+                fieldOffsets[i] = tableSize;
+                tableSize += (size_t)size;
+            }
+        }
+    }
+
+    size_t vtable = fbAppend(fb, NULL, 4 + 2 * (size_t)count, 2);
+    fbPutNumber(fb, vtable, 4 + 2 * (uint64_t)count, 2);
+    fbPutNumber(fb, vtable + 2, tableSize, 2);
+    for (int i = 0; i < count; i++) {
+        fbPutNumber(fb, vtable + 4 + 2 * (size_t)i, (fields[i].size > 0) ? fieldOffsets[i] : 0, 2);
+    }
+
+    size_t table = fbAppend(fb, NULL, tableSize, 8);
+    fbPutNumber(fb, table, table - vtable, 4);
+    for (int i = 0; i < count; i++) {
+        if (fields[i].size > 0) {
+            fields[i].position = table + fieldOffsets[i];
+            fbPutNumber(fb, fields[i].position, fields[i].value, fields[i].size);
+        }
+    }
+    return table;
+}
+
+// fbString - Appends a string: u32 length, the bytes, a '\0'
+// Returns: Position of the string
+size_t fbString(FLATBUFFER *fb, const char *text) {
+    size_t length = strlen(text);
+    size_t position = fbAppend(fb, NULL, 4 + length + 1, 4);
+    fbPutNumber(fb, position, length, 4);
+    memcpy(fb->data + position + 4, text, length);
+    return position;
+}
+
+// fbVector - Appends a vector: u32 element count, then the elements (NULL
+// for zeroed placeholders). Elements start on an 8-byte boundary, which
+// the 16-byte structs of Arrow record batches need.
+// Returns: Position of the vector (its count)
+size_t fbVector(FLATBUFFER *fb, const unsigned char *elements, int count, int elementSize) {
+    while ((fb->used + 4) % 8 != 0) {
+        fbAppend(fb, NULL, 1, 1);
+    }
+    size_t position = fbAppend(fb, NULL, 4, 4);
+    fbPutNumber(fb, position, (uint64_t)count, 4);
+    fbAppend(fb, elements, (size_t)count * (size_t)elementSize, 1);
+    return position;
+}
+
+// fbIntType - Appends an Arrow Int type table
+size_t fbIntType(FLATBUFFER *fb, int bitWidth, int isSigned) {
+    FB_FIELD fields[2] = {{4, (uint64_t)bitWidth, 0}, {1, (uint64_t)isSigned, 0}};
+    return fbTable(fb, fields, 2);
+}
+
+// fbArrowField - Appends an Arrow Field: a non-nullable utf8 or uint32
+// column; with dictionary set, a utf8 column dictionary-encoded with int8
+// indices into dictionary 0
+// Returns: Position of the Field table
+size_t fbArrowField(FLATBUFFER *fb, const char *name, int isString, int dictionary) {
+    // name, nullable, type_type, type, dictionary, children
+    FB_FIELD fields[6] = {
+        {4, 0, 0}, {1, 0, 0}, {1, isString ? 5 : 2, 0}, {4, 0, 0},
+        {dictionary ? 4 : 0, 0, 0}, {4, 0, 0}
+    };
+    size_t field = fbTable(fb, fields, 6);
+    fbPatch(fb, fields[0].position, fbString(fb, name));
+    if (isString) {
+        fbPatch(fb, fields[3].position, fbTable(fb, NULL, 0));   // Utf8 has no fields
+    } else {
+        fbPatch(fb, fields[3].position, fbIntType(fb, 32, 0));
     }
+    if (dictionary) {
+        // id, indexType, isOrdered
+        FB_FIELD encoding[3] = {{8, 0, 0}, {4, 0, 0}, {1, 0, 0}};
+        fbPatch(fb, fields[4].position, fbTable(fb, encoding, 3));
+        fbPatch(fb, encoding[1].position, fbIntType(fb, 8, 1));
+    }
+    fbPatch(fb, fields[5].position, fbVector(fb, NULL, 0, 4));
+    return field;
+}
 
-    // All arguments are valid!
-    return 1;
+// fbArrowMessage - Starts a flatbuffer holding an Arrow Message (version,
+// header type, header, body length)
+// Returns: Position of the header offset field, to patch to the header
+size_t fbArrowMessage(FLATBUFFER *fb, int headerType, long long bodyLength) {
+    fb->used = 0;
+    size_t root = fbAppend(fb, NULL, 4, 4);
+    FB_FIELD fields[4] = {
+        {2, ARROW_METADATA_V5, 0}, {1, (uint64_t)headerType, 0},
+        {4, 0, 0}, {8, (uint64_t)bodyLength, 0}
+    };
+    fbPatch(fb, root, fbTable(fb, fields, 4));
+    return fields[2].position;
 }
 
-// =============================================================================
-// LINE ANALYSIS FUNCTIONS
-// =============================================================================
+// buildArrowSchema - The Schema message: section (dictionary-encoded),
+// item (utf8), count, position and length (uint32)
+void buildArrowSchema(FLATBUFFER *fb) {
+    static const char *names[ARROW_COLUMNS] = {"section", "item", "count", "position", "length"};
+    size_t header = fbArrowMessage(fb, 1, 0);
+
+    // endianness (little), fields
+    FB_FIELD schema[2] = {{2, 0, 0}, {4, 0, 0}};
+    fbPatch(fb, header, fbTable(fb, schema, 2));
+    size_t fieldList = fbVector(fb, NULL, ARROW_COLUMNS, 4);
+    fbPatch(fb, schema[1].position, fieldList);
+    for (int i = 0; i < ARROW_COLUMNS; i++) {
+        fbPatch(fb, fieldList + 4 + 4 * (size_t)i, fbArrowField(fb, names[i], i < 2, i == 0));
+    }
+}
 
-// insertLine - Inserts a line into an alphabetically sorted doubly-linked list
-// Same logic as insertWord, but for lines
-WORD* insertLine(WORD *head, char *line, int position) {
-    // Check if this line already exists
-    WORD *current = head;
-    while (current != NULL) {
-        if (strcmp(current->contents, line) == 0) {
-            // DUPLICATE LINE FOUND!
-            current->frequency++;
-            return head;
+// buildArrowBatch - A RecordBatch message, or with dictionaryId >= 0 a
+// DictionaryBatch wrapping one
+// Parameters:
+//   rows: Rows in the batch (every column has this many, none null)
+//   buffers: Offset and length of each body buffer
+void buildArrowBatch(FLATBUFFER *fb, int dictionaryId, long long rows,
+                     const long long buffers[][2], int bufferCount, long long bodyLength) {
+    unsigned char nodes[ARROW_COLUMNS * 16];
+    unsigned char layout[ARROW_BUFFERS * 16];
+    int columns = (bufferCount == ARROW_BUFFERS) ? ARROW_COLUMNS : 1;
+    for (int i = 0; i < columns; i++) {
+        for (int byte = 0; byte < 8; byte++) {
+            nodes[i * 16 + byte] = (unsigned char)(((uint64_t)rows >> (8 * byte)) & 0xFF);
+            nodes[i * 16 + 8 + byte] = 0;   // null_count
         }
-        current = current->nextWord;
     }
-
-    // Create new node for new line
-    WORD *newNode = (WORD *)malloc(sizeof(WORD));
-    if (newNode == NULL) {
-        printf("ERROR: Memory allocation failed\n");
-        exit(1);
+    for (int i = 0; i < bufferCount; i++) {
+        for (int byte = 0; byte < 8; byte++) {
+            layout[i * 16 + byte] = (unsigned char)(((uint64_t)buffers[i][0] >> (8 * byte)) & 0xFF);
+            layout[i * 16 + 8 + byte] = (unsigned char)(((uint64_t)buffers[i][1] >> (8 * byte)) & 0xFF);
+        }
     }
 
-    newNode->contents = (char *)malloc(strlen(line) + 1);
-    if (newNode->contents == NULL) {
-        printf("ERROR: Memory allocation failed\n");
-        free(newNode);
-        exit(1);
+    size_t header = fbArrowMessage(fb, (dictionaryId >= 0) ? 2 : 3, bodyLength);
+    if (dictionaryId >= 0) {
+        // id, data, isDelta
+        FB_FIELD dictionaryBatch[3] = {{8, (uint64_t)dictionaryId, 0}, {4, 0, 0}, {1, 0, 0}};
+        fbPatch(fb, header, fbTable(fb, dictionaryBatch, 3));
+        header = dictionaryBatch[1].position;
     }
-    strcpy(newNode->contents, line);
 
-    newNode->numChars = strlen(line);
-    newNode->frequency = 1;
-    newNode->orderAppeared = position;
-    newNode->nextWord = NULL;
-    newNode->prevWord = NULL;
+    // length, nodes, buffers
+    FB_FIELD batch[3] = {{8, (uint64_t)rows, 0}, {4, 0, 0}, {4, 0, 0}};
+    fbPatch(fb, header, fbTable(fb, batch, 3));
+    fbPatch(fb, batch[1].position, fbVector(fb, nodes, columns, 16));
+    fbPatch(fb, batch[2].position, fbVector(fb, layout, bufferCount, 16));
+}
 
-    // If list is empty, this becomes the head
-    if (head == NULL) {
-        return newNode;
+// writeArrowMessage - Writes a message's metadata: the continuation token,
+// the metadata length, and the flatbuffer padded to 8 bytes
+void writeArrowMessage(RECORD_OUTPUT *out, FLATBUFFER *fb) {
+    while (fb->used % ARROW_ALIGNMENT != 0) {
+        fbAppend(fb, NULL, 1, 1);
     }
+    writeResultNumber(out, 0xFFFFFFFFU, 4);
+    writeResultNumber(out, fb->used, 4);
+    writeResultBytes(out, fb->data, fb->used);
+}
 
-    // Find correct insertion position (alphabetical order)
-    current = head;
-    while (current->nextWord != NULL && strcmp(current->contents, line) < 0) {
-        current = current->nextWord;
-    }
+// writeArrowPadding - Pads a body buffer of the given length to 8 bytes
+void writeArrowPadding(RECORD_OUTPUT *out, long long length) {
+    static const char padding[ARROW_ALIGNMENT] = {0};
+    writeResultBytes(out, padding, (size_t)((ARROW_ALIGNMENT - length % ARROW_ALIGNMENT) % ARROW_ALIGNMENT));
+}
 
-    // Insert before current?
-    if (strcmp(current->contents, line) > 0) {
-        newNode->nextWord = current;
-        newNode->prevWord = current->prevWord;
+// writeArrowStart - Starts a --format arrow stream
+// The stream is an Arrow IPC stream (the format pyarrow.ipc.open_stream and
+// DuckDB read): a Schema message, a DictionaryBatch with the section names,
+// then one or more RecordBatch messages per section (see writeArrowBatch)
+// and an end-of-stream marker. Every section shares one table layout:
+//   section   dictionary<int8, utf8>  "char", "word", "line",
+//                                     "longest_word", "longest_line"
+//   item      utf8                    The character, word or line
+//   count     uint32                  Frequency
+//   position  uint32                  First position
+//   length    uint32                  Length in bytes
+// The metadata flatbuffers are built by hand (fbTable and friends); the
+// body buffers come straight from the row columns and the string pool.
+void writeArrowStart(RECORD_OUTPUT *out) {
+    FLATBUFFER fb;
+    memset(&fb, 0, sizeof(FLATBUFFER));
+
+    buildArrowSchema(&fb);
+    writeArrowMessage(out, &fb);
+
+    // The dictionary: one utf8 column holding the section names, in
+    // FLAG_C..FLAG_LL order so a section's index is its flag
+    const char *names = "charwordlinelongest_wordlongest_line";
+    uint32_t offsets[FLAG_LL + 2];
+    offsets[0] = 0;
+    for (int flag = FLAG_C; flag <= FLAG_LL; flag++) {
+        offsets[flag + 1] = offsets[flag] + (uint32_t)strlen(recordSectionName(flag));
+    }
+    long long namesLength = (long long)strlen(names);
+    long long offsetsBytes = (long long)sizeof(offsets);
+    long long paddedOffsets = (offsetsBytes + ARROW_ALIGNMENT - 1) / ARROW_ALIGNMENT * ARROW_ALIGNMENT;
+    long long paddedNames = (namesLength + ARROW_ALIGNMENT - 1) / ARROW_ALIGNMENT * ARROW_ALIGNMENT;
+    long long buffers[3][2] = {{0, 0}, {0, offsetsBytes}, {paddedOffsets, namesLength}};
+    buildArrowBatch(&fb, 0, FLAG_LL + 1, buffers, 3, paddedOffsets + paddedNames);
+    writeArrowMessage(out, &fb);
+    writeResultColumn(out, offsets, FLAG_LL + 2);
+    writeArrowPadding(out, offsetsBytes);
+    writeResultBytes(out, names, (size_t)namesLength);
+    writeArrowPadding(out, namesLength);
+
+    free(fb.data);
+}
 
-        if (current->prevWord != NULL) {
-            current->prevWord->nextWord = newNode;
-        }
-        current->prevWord = newNode;
+// writeArrowBatch - Writes the rows gathered so far as one RecordBatch
+// Body buffers, each padded to 8 bytes: section validity (empty: nothing is
+// null) and int8 indices; item validity, int32 offsets and bytes; then
+// validity and data for count, position and length
+void writeArrowBatch(RECORD_OUTPUT *out) {
+    long long rows = out->rowCount;
+    long long lengths[ARROW_BUFFERS] = {
+        0, rows, 0, (rows + 1) * 4, (long long)out->poolUsed,
+        0, rows * 4, 0, rows * 4, 0, rows * 4
+    };
+    long long buffers[ARROW_BUFFERS][2];
+    long long bodyLength = 0;
+    for (int i = 0; i < ARROW_BUFFERS; i++) {
+        buffers[i][0] = bodyLength;
+        buffers[i][1] = lengths[i];
+        bodyLength += (lengths[i] + ARROW_ALIGNMENT - 1) / ARROW_ALIGNMENT * ARROW_ALIGNMENT;
+    }
 
-        if (current == head) {
-            return newNode;
+    FLATBUFFER fb;
+    memset(&fb, 0, sizeof(FLATBUFFER));
+    buildArrowBatch(&fb, -1, rows, (const long long (*)[2])buffers, ARROW_BUFFERS, bodyLength);
+    writeArrowMessage(out, &fb);
+    free(fb.data);
+
+    // section: every row has this section's index
+    char indices[4096];
+    memset(indices, out->sectionFlag, sizeof(indices));
+    for (long long done = 0; done < rows; done += (long long)sizeof(indices)) {
+        long long chunk = rows - done;
+        writeResultBytes(out, indices, (size_t)((chunk < (long long)sizeof(indices)) ? chunk : (long long)sizeof(indices)));
+    }
+    writeArrowPadding(out, rows);
+
+    // item: offsets are the running sum of the lengths
+    uint32_t offsets[1024];
+    uint32_t offset = 0;
+    long row = 0;
+    offsets[0] = 0;
+    int used = 1;
+    while (1) {
+        for (; row < out->rowCount && used < 1024; row++) {
+            offset += out->lengths[row];
+            offsets[used++] = offset;
         }
-        return head;
-    } else {
-        // Insert after current
-        newNode->prevWord = current;
-        newNode->nextWord = current->nextWord;
-
-        if (current->nextWord != NULL) {
-            current->nextWord->prevWord = newNode;
+        writeResultColumn(out, offsets, used);
+        used = 0;
+        if (row == out->rowCount) {
+            break;
         }
-        current->nextWord = newNode;
-
-        return head;
     }
+    writeArrowPadding(out, (rows + 1) * 4);
+    writeResultBytes(out, out->pool, out->poolUsed);
+    writeArrowPadding(out, (long long)out->poolUsed);
+
+    // count, position, length
+    writeResultColumn(out, out->counts, out->rowCount);
+    writeArrowPadding(out, rows * 4);
+    writeResultColumn(out, out->positions, out->rowCount);
+    writeArrowPadding(out, rows * 4);
+    writeResultColumn(out, out->lengths, out->rowCount);
+    writeArrowPadding(out, rows * 4);
+
+    out->rowCount = 0;
+    out->poolUsed = 0;
 }
 
-// buildLineList - Creates a linked list of all unique lines with their frequencies
-WORD* buildLineList(FILE *fp, int *totalLines, int *uniqueLines) {
-    WORD *head = NULL;
-    char buffer[MAX_LINE_LENGTH];
-    int lineIndex = 0;  // Track which line we're on (0-indexed)
+// =============================================================================
+// RUN STATISTICS FUNCTIONS
+// =============================================================================
 
-    *totalLines = 0;
-    *uniqueLines = 0;
+// Phase names for --stats, indexed by PHASE_*
+const char *phaseNames[PHASE_COUNT] = { "read", "chars", "scan", "sort", "render" };
 
-    // Read each line from the file
-    while (fgets(buffer, MAX_LINE_LENGTH, fp) != NULL) {
-        (*totalLines)++;
+// secondsBetween - Seconds from one clock reading to another
+double secondsBetween(struct timespec start, struct timespec end) {
+    return (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
 
-        // Remove trailing newline if present
-        if (buffer[strlen(buffer) - 1] == '\n') {
-            buffer[strlen(buffer) - 1] = '\0';
-        }
+// startRunStats - Clears the statistics and takes the first clock (and,
+// with --perf-counters, counter) readings
+void startRunStats(RUN_STATS *stats, int perfCounters) {
+    memset(stats, 0, sizeof(RUN_STATS));
+    stats->perfCounters = perfCounters && openPerfCounters();
+    if (stats->perfCounters) {
+        readPerfCounters(stats->perfLast);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stats->lastWall);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stats->lastCpu);
+}
 
-        head = insertLine(head, buffer, lineIndex);
-        lineIndex++;
+// markPhase - Ends a phase: the time since the last boundary is charged to it
+// A phase can be marked more than once (--time-buckets scans per bucket);
+// its times add up.
+void markPhase(RUN_STATS *stats, int phase) {
+    struct timespec wall, cpu;
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    stats->wall[phase] += secondsBetween(stats->lastWall, wall);
+    stats->cpu[phase] += secondsBetween(stats->lastCpu, cpu);
+    stats->lastWall = wall;
+    stats->lastCpu = cpu;
+
+    if (stats->perfCounters) {
+        uint64_t counts[PERF_EVENT_COUNT];
+        readPerfCounters(counts);
+        for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+            stats->perf[phase][i] += counts[i] - stats->perfLast[i];
+            stats->perfLast[i] = counts[i];
+        }
     }
+}
 
-    // Count unique lines by traversing the list
-    WORD *current = head;
-    while (current != NULL) {
-        (*uniqueLines)++;
-        current = current->nextWord;
+// noteTableSize - Records the word and line tables' sizes as counting ends
+// (NULL = no such table). With --time-buckets the biggest bucket's are kept.
+void noteTableSize(RUN_STATS *stats, WORD_TABLE *wordTable, WORD_TABLE *lineTable) {
+    if (wordTable != NULL && wordTable->tableSize >= stats->wordSlots) {
+        stats->wordEntries = wordTable->uniqueCount;
+        stats->wordSlots = wordTable->tableSize;
     }
+    if (lineTable != NULL && lineTable->tableSize >= stats->lineSlots) {
+        stats->lineEntries = lineTable->uniqueCount;
+        stats->lineSlots = lineTable->tableSize;
+    }
+}
 
-    return head;
+// printUniqueCount - Prints a --stats "Words:"/"Lines:" row; Unique is n/a
+// when no table was built to count it
+void printUniqueCount(FILE *outputFile, const char *label, int total, int unique, int counted) {
+    if (counted) {
+        fprintf(outputFile, "%s: %d, Unique: %d\n", label, total, unique);
+    } else {
+        fprintf(outputFile, "%s: %d, Unique: n/a\n", label, total);
+    }
 }
 
-// printLineAnalysis - Prints line statistics
-void printLineAnalysis(FILE *outputFile, WORD *lineHead, int totalLines, int uniqueLines) {
-    fprintf(outputFile, "Total Number of Lines: %d\n", totalLines);
-    fprintf(outputFile, "Total Unique Lines: %d\n\n", uniqueLines);
+// printRunStats - Prints the --stats report
+// Only counts this run made are printed: the word and line rows need the
+// whole file scanned in one go (not with --diff or --time-buckets), words
+// are only split out for -w/-Lw/-hw, and Unique Chars needs -c or -c2
+void printRunStats(FILE *outputFile, RUN_STATS *stats, REPORT_DATA *report) {
+    OPTIONS *options = report->options;
+    TEXT_SCAN *scan = report->scan;
+    double totalWall = 0.0;
+    double totalCpu = 0.0;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        totalWall += stats->wall[i];
+        totalCpu += stats->cpu[i];
+    }
 
-    // List is already sorted alphabetically
-    WORD *current = lineHead;
-    while (current != NULL) {
-        fprintf(outputFile, "Line: %s, Freq: %d, Initial Position: %d\n",
-               current->contents, current->frequency, current->orderAppeared);
-        current = current->nextWord;
+    // ru_maxrss is in kilobytes on Linux but in bytes on macOS
+    struct rusage usage;
+    long peakRss = 0;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        peakRss = usage.ru_maxrss;
+#ifdef __APPLE__
+        peakRss /= 1024;
+#endif
     }
-}
 
-// freeLineList - Deallocates all nodes in the line list
-void freeLineList(WORD *head) {
-    WORD *current = head;
-    while (current != NULL) {
-        WORD *temp = current;
-        current = current->nextWord;
-        free(temp->contents);
-        free(temp);
+    fprintf(outputFile, "Stats:\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(outputFile, "Phase: %s, Wall: %.6f s, CPU: %.6f s\n",
+                phaseNames[i], stats->wall[i], stats->cpu[i]);
     }
+    fprintf(outputFile, "Phase: total, Wall: %.6f s, CPU: %.6f s\n", totalWall, totalCpu);
+    fprintf(outputFile, "Bytes: %lld\n", stats->bytes);
+    fprintf(outputFile, "Throughput: %.2f MB/s\n",
+            (totalWall > 0.0) ? stats->bytes / 1048576.0 / totalWall : 0.0);
+    int wholeFile = options->diffFile == NULL && options->timeFormat == 0;
+    int wordsCounted = scan->buildWordList || scan->wordLengths != NULL;
+    if (wholeFile && wordsCounted) {
+        printUniqueCount(outputFile, "Words", scan->totalWords, scan->uniqueWords,
+                         scan->buildWordList);
+    }
+    if (wholeFile && report->linesPresorted) {
+        printUniqueCount(outputFile, "Lines", report->sortedLines->totalLines,
+                         report->sortedLines->uniqueLines, 1);
+    } else if (wholeFile && (wordsCounted || scan->buildLineList || scan->lineLengths != NULL)) {
+        printUniqueCount(outputFile, "Lines", scan->totalLines, scan->uniqueLines,
+                         scan->buildLineList);
+    }
+    if (options->requestCharAnalysis || options->requestPairAnalysis) {
+        fprintf(outputFile, "Unique Chars: %d\n", report->uniqueCharCount);
+    }
+    if (stats->wordSlots > 0) {
+        fprintf(outputFile, "Word Table: %d entries, %d slots, Load: %.2f\n",
+                stats->wordEntries, stats->wordSlots,
+                (double)stats->wordEntries / stats->wordSlots);
+    }
+    if (stats->lineSlots > 0) {
+        fprintf(outputFile, "Line Table: %d entries, %d slots, Load: %.2f\n",
+                stats->lineEntries, stats->lineSlots,
+                (double)stats->lineEntries / stats->lineSlots);
+    }
+    fprintf(outputFile, "Peak RSS: %ld kB\n", peakRss);
 }
 
 // =============================================================================
-// LONGEST WORD/LINE FUNCTIONS
+// HARDWARE COUNTER FUNCTIONS (--perf-counters)
 // =============================================================================
 
-// printLongestWord - Finds and prints the longest word(s)
-void printLongestWord(FILE *outputFile, WORD *wordHead) {
-    if (wordHead == NULL) {
-        return;
+// Event names for --perf-counters, indexed by PERF_*
+const char *perfEventNames[PERF_EVENT_COUNT] = {
+    "Cycles", "Instructions", "Cache Misses", "Branch Misses", "dTLB Misses"
+};
+
+// The counters are opened on first use and left open for the rest of the
+// process, so every batch entry reads the same group
+int perfFds[PERF_EVENT_COUNT];
+int perfOpenError = -1;   // -1 = not opened yet, 0 = counting, otherwise the errno
+
+// openPerfCounters - Opens the hardware counters (once) as one
+// perf_event_open group led by the cycle counter, so they are scheduled
+// onto the PMU together. Only user-space counts are asked for, which
+// perf_event_paranoid allows up to level 2. Threads started later (the -o
+// fan-out renderers) are counted too. An event the CPU doesn't have is
+// left out (its fd is -1).
+// Returns: 1 if the cycle counter is running, 0 if not (perfOpenError says why)
+int openPerfCounters() {
+    if (perfOpenError >= 0) {
+        return perfOpenError == 0;
+    }
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+        perfFds[i] = -1;
+    }
+#ifdef __linux__
+    const uint32_t types[PERF_EVENT_COUNT] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+    };
+    const uint64_t configs[PERF_EVENT_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    };
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.disabled = (i == PERF_CYCLES);   // The group starts when its leader does
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perfFds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1,
+                                  (i == PERF_CYCLES) ? -1 : perfFds[PERF_CYCLES], 0);
+        if (perfFds[PERF_CYCLES] < 0) {
+            perfOpenError = (errno != 0) ? errno : ENOENT;
+            return 0;
+        }
+        if (perfFds[i] >= 0) {
+            fcntl(perfFds[i], F_SETFD, FD_CLOEXEC);   // Not into --compress children
+        }
     }
+    ioctl(perfFds[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, 0);
+    perfOpenError = 0;
+    return 1;
+#else
+    perfOpenError = ENOSYS;   // perf_event_open is Linux only
+    return 0;
+#endif
+}
 
-    // Find the maximum length among all words
-    int maxLength = 0;
-    WORD *current = wordHead;
-    while (current != NULL) {
-        if (current->numChars > maxLength) {
-            maxLength = current->numChars;
+// readPerfCounters - Reads every counter (0 for the ones left out)
+// If the PMU had to time-share the group, the counts are scaled up to the
+// whole time it was enabled
+void readPerfCounters(uint64_t values[]) {
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+        uint64_t reading[3] = { 0, 0, 0 };   // Value, time enabled, time running
+        values[i] = 0;
+        if (perfFds[i] < 0 || read(perfFds[i], reading, sizeof(reading)) != sizeof(reading)) {
+            continue;
+        }
+        values[i] = reading[0];
+        if (reading[2] > 0 && reading[2] < reading[1]) {
+            values[i] = (uint64_t)((double)reading[0] * reading[1] / reading[2]);
         }
-        current = current->nextWord;
     }
+}
 
-    // Collect all words with maximum length
-    WORD **longestWords = (WORD **)malloc(sizeof(WORD *) * 1000);
-    int longestCount = 0;
+// printPerfCount - Prints ", <name>: <count>" (n/a for an event left out)
+void printPerfCount(FILE *outputFile, const char *name, uint64_t count, int event) {
+    if (perfFds[event] < 0) {
+        fprintf(outputFile, ", %s: n/a", name);
+    } else {
+        fprintf(outputFile, ", %s: %llu", name, (unsigned long long)count);
+    }
+}
 
-    current = wordHead;
-    while (current != NULL) {
-        if (current->numChars == maxLength) {
-            longestWords[longestCount++] = current;
-        }
-        current = current->nextWord;
+// printPerfCounters - Prints the --perf-counters report: each phase's
+// counts and instructions per cycle, then the whole run's counts per byte
+// of input. Without counters (no PMU, a container, perf_event_paranoid
+// too high) it says why in one line and the run goes on as normal.
+void printPerfCounters(FILE *outputFile, RUN_STATS *stats) {
+    if (!stats->perfCounters) {
+        fprintf(outputFile, "Perf Counters: unavailable (%s)\n", strerror(perfOpenError));
+        return;
     }
 
-    // Sort the longest words alphabetically
-    // (They might not be consecutive in the original list)
-    for (int i = 0; i < longestCount - 1; i++) {
-        for (int j = i + 1; j < longestCount; j++) {
-            if (strcmp(longestWords[i]->contents, longestWords[j]->contents) > 0) {
-                // Swap
-                WORD *temp = longestWords[i];
-                longestWords[i] = longestWords[j];
-                longestWords[j] = temp;
+    uint64_t total[PERF_EVENT_COUNT];
+    memset(total, 0, sizeof(total));
+    fprintf(outputFile, "Perf Counters:\n");
+    for (int phase = 0; phase <= PHASE_COUNT; phase++) {
+        uint64_t *counts = total;
+        if (phase < PHASE_COUNT) {
+            counts = stats->perf[phase];
+            for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+                total[i] += counts[i];
             }
         }
+        fprintf(outputFile, "Phase: %s", (phase < PHASE_COUNT) ? phaseNames[phase] : "total");
+        for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+            printPerfCount(outputFile, perfEventNames[i], counts[i], i);
+        }
+        if (perfFds[PERF_INSTRUCTIONS] >= 0) {
+            fprintf(outputFile, ", IPC: %.2f", (counts[PERF_CYCLES] > 0)
+                    ? (double)counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES] : 0.0);
+        }
+        fprintf(outputFile, "\n");
     }
 
-    // Print the longest word(s)
-    fprintf(outputFile, "Longest Word is %d characters long:\n", maxLength);
-    for (int i = 0; i < longestCount; i++) {
-        fprintf(outputFile, "\t%s\n", longestWords[i]->contents);
+    fprintf(outputFile, "Per Byte:");
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+        if (perfFds[i] >= 0) {
+            fprintf(outputFile, "%s %s: %.4f", (i == 0) ? "" : ",", perfEventNames[i],
+                    (stats->bytes > 0) ? (double)total[i] / stats->bytes : 0.0);
+        }
     }
-
-    free(longestWords);
+    fprintf(outputFile, "\n");
 }
 
-// printLongestLine - Finds and prints the longest line(s)
-void printLongestLine(FILE *outputFile, WORD *lineHead) {
-    if (lineHead == NULL) {
-        return;
-    }
+// =============================================================================
+// REPORT RENDERING FUNCTIONS
+// =============================================================================
 
-    // Find the maximum length among all lines
-    int maxLength = 0;
-    WORD *current = lineHead;
-    while (current != NULL) {
-        if (current->numChars > maxLength) {
-            maxLength = current->numChars;
+// printTextReport - Prints the text report: the sections in the ORDER the
+// flags appeared on the command line, then the --time-buckets sections
+// We add ONE blank line BEFORE each section (except the very first one)
+// so sections are separated by exactly one blank line.
+void printTextReport(FILE *outputFile, REPORT_DATA *report) {
+    OPTIONS *options = report->options;
+    TEXT_SCAN *scan = report->scan;
+    int firstSection = 1;  // Tracks if we've printed anything yet
+
+    for (int i = 0; i < options->flagCount; i++) {
+        // With --time-buckets, word and line sections are printed per bucket below
+        if (report->bucketData != NULL && isScanSection(options->flagOrder[i])) {
+            continue;
         }
-        current = current->nextWord;
-    }
 
-    // Collect all lines with maximum length
-    WORD **longestLines = (WORD **)malloc(sizeof(WORD *) * 1000);
-    int longestCount = 0;
+        // Add separator before every section except the first
+        if (!firstSection) {
+            fprintf(outputFile, "\n");
+        }
 
-    current = lineHead;
-    while (current != NULL) {
-        if (current->numChars == maxLength) {
-            longestLines[longestCount++] = current;
+        switch (options->flagOrder[i]) {
+            case FLAG_C:
+                printCharacterAnalysis(outputFile, report->charFrequency, report->charFirstPos,
+                                       (int)report->dataSize, report->uniqueCharCount);
+                firstSection = 0;
+                break;
+
+            case FLAG_C2:
+                printPairAnalysis(outputFile, report->pairFrequency,
+                                  (report->dataSize > 0) ? (int)report->dataSize - 1 : 0,
+                                  options->pairTopCount);
+                firstSection = 0;
+                break;
+
+            case FLAG_CU:
+                printCodePointAnalysis(outputFile, report->codePoints);
+                firstSection = 0;
+                break;
+
+            default:
+                // Word and line sections
+                if (options->diffFile != NULL) {
+                    if (options->flagOrder[i] == FLAG_W) {
+                        printDiffSection(outputFile, report->diffWords, "Word", "Words",
+                                         report->diffWordsA, scan->totalWords, options->diffRank);
+                    } else {
+                        printDiffSection(outputFile, report->diffLines, "Line", "Lines",
+                                         report->diffLinesA, scan->totalLines, options->diffRank);
+                    }
+                    firstSection = 0;
+                } else if (report->linesPresorted &&
+                           (options->flagOrder[i] == FLAG_L || options->flagOrder[i] == FLAG_LL)) {
+                    if (printSortedLines(outputFile, report->fileData, report->dataSize,
+                                         report->scanFilter, report->sortedLines,
+                                         options->flagOrder[i] == FLAG_LL)) {
+                        firstSection = 0;
+                    }
+                } else if (printScanSection(outputFile, options->flagOrder[i], scan)) {
+                    firstSection = 0;
+                }
+                break;
         }
-        current = current->nextWord;
     }
 
-    // Sort the longest lines alphabetically
-    for (int i = 0; i < longestCount - 1; i++) {
-        for (int j = i + 1; j < longestCount; j++) {
-            if (strcmp(longestLines[i]->contents, longestLines[j]->contents) > 0) {
-                // Swap
-                WORD *temp = longestLines[i];
-                longestLines[i] = longestLines[j];
-                longestLines[j] = temp;
-            }
+    if (report->bucketData != NULL) {
+        if (!firstSection) {
+            fprintf(outputFile, "\n");
         }
+        printTimeBuckets(outputFile, options, scan, report->bucketData, report->buckets);
     }
+}
 
-    // Print the longest line(s)
-    fprintf(outputFile, "Longest Line is %d characters long:\n", maxLength);
-    for (int i = 0; i < longestCount; i++) {
-        fprintf(outputFile, "\t%s\n", longestLines[i]->contents);
+// renderTarget - Writes one target's report in its format
+void renderTarget(OUTPUT_TARGET *target, REPORT_DATA *report) {
+    if (target->format == FORMAT_TEXT) {
+        printTextReport(target->fp, report);
+    } else {
+        // --format: the same sections as records, through the buffered writer
+        writeStructuredReport(target->fp, report->options, target->format,
+                              report->charFrequency, report->charFirstPos,
+                              (int)report->dataSize, report->uniqueCharCount, report->scan);
     }
-
-    free(longestLines);
 }
 
-// analyzeCharacters - Counts frequency and position of each character
-// Reads file character by character and tracks:
-// - How many times each character appears
-// - The first position each character appears at
-void analyzeCharacters(FILE *fp,
-                      int charFrequency[],
-                      int charFirstPos[],
-                      int *uniqueCharCount) {
-    int c;
-    int charPosition = 0;
+// renderTargetThread - Thread entry point: renderTarget() for a RENDER_JOB
+void* renderTargetThread(void *job) {
+    RENDER_JOB *renderJob = (RENDER_JOB *)job;
+    renderTarget(renderJob->target, renderJob->report);
+    return NULL;
+}
 
-    // Initialize arrays to 0
-    for (int i = 0; i < ASCII_RANGE; i++) {
-        charFrequency[i] = 0;
-        charFirstPos[i] = 0;
+// renderTargets - Writes every target's report from the one analysis
+// With several -o fmt:path outputs, each --format target is written on its
+// own thread: those renderers only read the analysis. Text targets are
+// printed one after another on this thread meanwhile, since the text
+// renderers share state (the --diff and -c2 sort comparators, the --regex
+// DFA cache that --time-buckets and --presorted fill in).
+void renderTargets(OUTPUT_TARGET targets[], int count, REPORT_DATA *report) {
+    if (count == 1) {
+        renderTarget(&targets[0], report);
+        return;
     }
 
-    *uniqueCharCount = 0;
+    // Fill in the CRC-32 table now rather than racing to on first use
+    updateCrc32(0, NULL, 0);
 
-    // Read file character by character
-    while ((c = fgetc(fp)) != EOF) {
-        // For each character, increment its frequency
-        if (charFrequency[c] == 0) {
-            // First time seeing this character
-            *uniqueCharCount += 1;
-            charFirstPos[c] = charPosition;
+    RENDER_JOB jobs[MAX_OUTPUT_TARGETS];
+    for (int i = 0; i < count; i++) {
+        jobs[i].target = &targets[i];
+        jobs[i].report = report;
+        jobs[i].threaded = targets[i].format != FORMAT_TEXT &&
+                           pthread_create(&jobs[i].thread, NULL, renderTargetThread,
+                                          &jobs[i]) == 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!jobs[i].threaded) {
+            renderTarget(&targets[i], report);   // Text, or no thread to be had
         }
-        charFrequency[c]++;
-        charPosition++;
     }
-}
-
-// printCharacterAnalysis - Prints all character statistics
-void printCharacterAnalysis(FILE *outputFile,
-                           int charFrequency[],
-                           int charFirstPos[],
-                           int totalCharCount,
-                           int uniqueCharCount) {
-    fprintf(outputFile, "Total Number of Chars = %d\n", totalCharCount);
-    fprintf(outputFile, "Total Unique Chars = %d\n\n", uniqueCharCount);
-
-    // Loop through all ASCII values (0-127) and print if character appeared
-    for (int i = 0; i < ASCII_RANGE; i++) {
-        if (charFrequency[i] > 0) {
-            // Character appeared in file
-            fprintf(outputFile, "Ascii Value: %d, Char: %c, Count: %d, Initial Position: %d\n",
-                   i, i, charFrequency[i], charFirstPos[i]);
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].threaded) {
+            pthread_join(jobs[i].thread, NULL);
         }
     }
 }
@@ -820,18 +6529,26 @@ void printCharacterAnalysis(FILE *outputFile,
 // analyzeFile - Main function for analyzing a single file
 // Returns: 1 on success, 0 on error
 // =============================================================================
-int analyzeFile(char *inputFile,
-                 char *outputFile,
-                 int requestCharAnalysis,
-                 int requestWordAnalysis,
-                 int requestLineAnalysis,
-                 int requestLongestWord,
-                 int requestLongestLine,
-                 int flagOrder[],
-                 int flagCount) {
+int analyzeFile(OPTIONS *options) {
+
+    // --dump: print a saved --format bin file instead of analyzing one
+    if (options->dumpFile != NULL) {
+        return dumpResultFile(options->dumpFile, options->outputFile);
+    }
+
+    // --stats, --perf-counters: the clocks (and counters) start now
+    RUN_STATS runStats;
+    RUN_STATS *stats = NULL;
+    if (options->stats || options->perfCounters) {
+        stats = &runStats;
+        startRunStats(stats, options->perfCounters);
+    }
+
+    // --alloc-stats: count from here (and not at all without it)
+    startAllocStats(options->allocStats);
 
     // Try to open the input file for reading
-    FILE *inputFP = fopen(inputFile, "r");
+    FILE *inputFP = fopen(options->inputFile, "r");
     if (inputFP == NULL) {
         // File cannot be opened (doesn't exist, permission denied, etc.)
         printInputFileError();
@@ -849,111 +6566,291 @@ int analyzeFile(char *inputFile,
         return 0;  // Error
     }
 
-    // Determine output destination: file or stdout
-    FILE *outputFP = stdout;
-    if (outputFile != NULL) {
-        outputFP = fopen(outputFile, "w");
-        if (outputFP == NULL) {
-            printf("ERROR: Can't open output file\n");
-            fclose(inputFP);
-            return 0;  // Error
-        }
+    // Determine output destinations: every -o fmt:path, or else one file
+    // (compressed with --compress) or stdout
+    OUTPUT_TARGET targets[MAX_OUTPUT_TARGETS];
+    int targetCount = collectOutputTargets(options, targets);
+    if (!openOutputTargets(targets, targetCount, options->compress)) {
+        fclose(inputFP);
+        return 0;  // Error
     }
 
     // =========================================================================
     // PHASE 1: Build all data structures (silently, regardless of print order)
     // =========================================================================
 
-    // CHARACTER data (only if -c requested)
+    // Read the file once; every analysis below works from this copy
+    // (fewer bytes than fileSize if the file shrank since it was measured)
+    long readSize = 0;
+    char *fileData = readInputFile(inputFP, fileSize, &readSize);
+    long dataSize = readSize;
+    long bufferSize = fileSize;   // fileData's allocation, less its '\0' byte
+
+    // --match: build the line filter. Normally it is applied inside the text
+    // scan; with --match-chars the file is cut down to its matching lines up
+    // front instead, so the character analyses only see those lines too.
+    LINE_FILTER lineFilter;
+    memset(&lineFilter, 0, sizeof(LINE_FILTER));
+    for (int i = 0; i < options->matchCount; i++) {
+        lineFilter.patterns[i] = options->matchPatterns[i];
+        lineFilter.patternLengths[i] = (int)strlen(options->matchPatterns[i]);
+    }
+    lineFilter.patternCount = options->matchCount;
+    lineFilter.matchAny = options->matchAny;
+
+    // --regex: compile it to its DFA matcher
+    if (options->regexPattern != NULL) {
+        lineFilter.regex = compileRegex(options->regexPattern);
+        if (lineFilter.regex == NULL) {
+            printInvalidRegexError();
+            trackedFree(fileData, (size_t)bufferSize + 1, MEM_BUFFERS);
+            fclose(inputFP);
+            closeOutputTargets(targets, targetCount);
+            return 0;  // Error
+        }
+    }
+
+    LINE_FILTER *scanFilter = (lineFilter.patternCount > 0 || lineFilter.regex != NULL)
+                              ? &lineFilter : NULL;
+    if (scanFilter != NULL && options->matchChars && options->diffFile == NULL) {
+        char *matchingLines = keepMatchingLines(fileData, readSize, &lineFilter, &dataSize);
+        trackedFree(fileData, (size_t)bufferSize + 1, MEM_BUFFERS);
+        bufferSize = readSize;
+        fileData = matchingLines;
+        scanFilter = NULL;   // Already applied
+    }
+    if (stats != NULL) {
+        stats->bytes = readSize;
+        markPhase(stats, PHASE_READ);
+    }
+
+    // CHARACTER data (if -c or -c2 requested; both come from the same pass)
     int charFrequency[ASCII_RANGE];
     int charFirstPos[ASCII_RANGE];
     int uniqueCharCount = 0;
-    if (requestCharAnalysis) {
-        analyzeCharacters(inputFP, charFrequency, charFirstPos, &uniqueCharCount);
-        fseek(inputFP, 0, SEEK_SET);
+    int *pairFrequency = NULL;
+    if (options->requestPairAnalysis) {
+        pairFrequency = (int *)trackedMalloc(sizeof(int) * PAIR_RANGE, MEM_TABLES);
+        if (pairFrequency == NULL) {
+            printf("ERROR: Memory allocation failed\n");
+            exit(1);
+        }
     }
-
-    // WORD LIST (build if -w or -Lw requested)
-    WORD *wordHead = NULL;
-    int totalWords = 0;
-    int uniqueWords = 0;
-    if (requestWordAnalysis || requestLongestWord) {
-        wordHead = buildWordList(inputFP, &totalWords, &uniqueWords);
-        fseek(inputFP, 0, SEEK_SET);
+    if (options->requestCharAnalysis || options->requestPairAnalysis) {
+        analyzeCharacters((const unsigned char *)fileData, dataSize,
+                          charFrequency, charFirstPos, &uniqueCharCount,
+                          pairFrequency);
     }
 
-    // LINE LIST (build if -l or -Ll requested)
-    WORD *lineHead = NULL;
-    int totalLines = 0;
-    int uniqueLines = 0;
-    if (requestLineAnalysis || requestLongestLine) {
-        lineHead = buildLineList(inputFP, &totalLines, &uniqueLines);
-        fseek(inputFP, 0, SEEK_SET);
+    // UTF-8 CODE POINT data (only if -cu requested; ASCII counts come from
+    // the pass above when there was one)
+    CODE_POINT_STATS codePoints;
+    memset(&codePoints, 0, sizeof(CODE_POINT_STATS));
+    if (options->requestCodePointAnalysis) {
+        int charsCounted = options->requestCharAnalysis || options->requestPairAnalysis;
+        analyzeCodePoints((const unsigned char *)fileData, dataSize,
+                          charsCounted ? charFrequency : NULL, &codePoints);
+    }
+    if (stats != NULL) {
+        markPhase(stats, PHASE_CHARS);
     }
 
-    // =========================================================================
-    // PHASE 2: Print sections in the ORDER the flags appeared on the command line
-    // =========================================================================
-    // We add ONE blank line BEFORE each section (except the very first one)
-    // so sections are separated by exactly one blank line.
-
-    int firstSection = 1;  // Tracks if we've printed anything yet
-
-    for (int i = 0; i < flagCount; i++) {
-        // Add separator before every section except the first
-        if (!firstSection) {
-            fprintf(outputFP, "\n");
+    // WORD and LINE data: lists for -w/-Lw and -l/-Ll, length histograms for
+    // -hw and -hl, all from one scan (histograms never touch the lists)
+    LENGTH_HISTOGRAM wordLengths;
+    LENGTH_HISTOGRAM lineLengths;
+    memset(&wordLengths, 0, sizeof(LENGTH_HISTOGRAM));
+    memset(&lineLengths, 0, sizeof(LENGTH_HISTOGRAM));
+
+    TEXT_SCAN scan;
+    memset(&scan, 0, sizeof(TEXT_SCAN));
+    scan.buildWordList = options->requestWordAnalysis || options->requestLongestWord ||
+                         options->positionsFile != NULL;
+    scan.recordPositions = options->positionsFile != NULL;
+    scan.buildLineList = options->requestLineAnalysis || options->requestLongestLine;
+    scan.foldCase = options->ignoreCase;
+    scan.printLowercase = options->printLowercase;
+
+    unsigned char charClass[BYTE_RANGE];
+    buildCharClassTable(charClass, options->extraDelims, options->stripPunct);
+    scan.charClass = charClass;
+    scan.stripPunct = options->stripPunct;
+    scan.lineFilter = scanFilter;
+    scan.column = options->column;
+    scan.separator = options->separator;
+    scan.sortOrder = options->sortOrder;
+    scan.sortDescending = options->sortDescending;
+
+    // --stopwords: load the set (case-insensitive along with -i)
+    STOPWORD_SET stopwords;
+    memset(&stopwords, 0, sizeof(STOPWORD_SET));
+    if (options->stopwordFile != NULL) {
+        if (!loadStopwords(&stopwords, options->stopwordFile, options->ignoreCase)) {
+            printStopwordFileError();
+            freeRegex(lineFilter.regex);
+            trackedFree(fileData, (size_t)bufferSize + 1, MEM_BUFFERS);
+            trackedFree(pairFrequency, sizeof(int) * PAIR_RANGE, MEM_TABLES);
+            trackedFree(codePoints.table, sizeof(CODE_POINT) * (size_t)codePoints.tableSize,
+                        MEM_TABLES);
+            fclose(inputFP);
+            closeOutputTargets(targets, targetCount);
+            return 0;  // Error
         }
+        scan.stopwords = &stopwords;
+        scan.countStopwords = options->countStopwords;
+    }
+    scan.wordLengths = options->requestWordHistogram ? &wordLengths : NULL;
+    scan.lineLengths = options->requestLineHistogram ? &lineLengths : NULL;
+    scan.stats = stats;
+
+    // --presorted: if the lines really are in order, -l and -Ll are printed
+    // straight from the file data and no line table is built. Otherwise (or
+    // with -i, where equal lines needn't be adjacent) the table is used.
+    SORTED_LINES sortedLines;
+    int linesPresorted = 0;
+    if (options->presorted && scan.buildLineList && !options->ignoreCase &&
+        options->sortOrder == SORT_ALPHA && !options->sortDescending &&
+        !usesStructuredOutput(options) &&
+        options->diffFile == NULL && options->timeFormat == 0) {
+        linesPresorted = checkSortedLines(fileData, dataSize, scanFilter, &sortedLines);
+        if (linesPresorted) {
+            scan.buildLineList = 0;
+        }
+    }
 
-        switch (flagOrder[i]) {
-            case FLAG_C:
-                printCharacterAnalysis(outputFP, charFrequency, charFirstPos,
-                                       (int)fileSize, uniqueCharCount);
-                firstSection = 0;
-                break;
-
-            case FLAG_W:
-                if (wordHead != NULL || totalWords == 0) {
-                    printWordAnalysis(outputFP, wordHead, totalWords, uniqueWords);
-                    firstSection = 0;
-                }
-                break;
+    // --time-buckets: group the lines by bucket now; each bucket is scanned
+    // on its own when it is printed. Otherwise scan the whole file.
+    BUCKET_SET buckets;
+    memset(&buckets, 0, sizeof(BUCKET_SET));
+    char *bucketData = NULL;
+
+    // --diff: count both files into the same tables, the second file into
+    // the second frequency column
+    WORD_TABLE diffWords;
+    WORD_TABLE diffLines;
+    int diffWordsA = 0, diffLinesA = 0;
+    if (options->diffFile != NULL) {
+        initWordTable(&diffWords, options->ignoreCase, options->printLowercase);
+        initWordTable(&diffLines, options->ignoreCase, options->printLowercase);
+        scan.wordTable = scan.buildWordList ? &diffWords : NULL;
+        scan.lineTable = scan.buildLineList ? &diffLines : NULL;
+        scanText(fileData, dataSize, &scan);
+        diffWordsA = scan.totalWords;
+        diffLinesA = scan.totalLines;
+
+        if (!countDiffFile(options->diffFile, &scan)) {
+            freeWordList(diffWords.head);
+            freeWordList(diffLines.head);
+            trackedFree(diffWords.slots, sizeof(WORD *) * (size_t)diffWords.tableSize, MEM_TABLES);
+            trackedFree(diffLines.slots, sizeof(WORD *) * (size_t)diffLines.tableSize, MEM_TABLES);
+            freeRegex(lineFilter.regex);
+            freeStopwords(&stopwords);
+            trackedFree(fileData, (size_t)bufferSize + 1, MEM_BUFFERS);
+            trackedFree(pairFrequency, sizeof(int) * PAIR_RANGE, MEM_TABLES);
+            trackedFree(codePoints.table, sizeof(CODE_POINT) * (size_t)codePoints.tableSize,
+                        MEM_TABLES);
+            fclose(inputFP);
+            closeOutputTargets(targets, targetCount);
+            return 0;  // Error
+        }
+    } else if (options->timeFormat != 0) {
+        bucketData = groupLinesByBucket(fileData, dataSize, options->timeFormat,
+                                        options->bucketWidth, &buckets);
+    } else if (scan.buildWordList || scan.buildLineList ||
+               scan.wordLengths != NULL || scan.lineLengths != NULL) {
+        scanText(fileData, dataSize, &scan);
+    }
+    if (stats != NULL) {
+        markPhase(stats, PHASE_SCAN);
+    }
 
-            case FLAG_L:
-                if (lineHead != NULL || totalLines == 0) {
-                    printLineAnalysis(outputFP, lineHead, totalLines, uniqueLines);
-                    firstSection = 0;
-                }
-                break;
+    // --positions: write the index before printing anything
+    if (options->positionsFile != NULL &&
+        !writePositionIndex(options->positionsFile, scan.wordHead, scan.uniqueWords,
+                            options->sortOrder == SORT_ALPHA && !options->sortDescending)) {
+        printPositionsFileError();
+        freeRegex(lineFilter.regex);
+        freeStopwords(&stopwords);
+        trackedFree(fileData, (size_t)bufferSize + 1, MEM_BUFFERS);
+        trackedFree(pairFrequency, sizeof(int) * PAIR_RANGE, MEM_TABLES);
+        trackedFree(codePoints.table, sizeof(CODE_POINT) * (size_t)codePoints.tableSize,
+                    MEM_TABLES);
+        freeWordList(scan.wordHead);
+        freeLineList(scan.lineHead);
+        fclose(inputFP);
+        closeOutputTargets(targets, targetCount);
+        return 0;  // Error
+    }
 
-            case FLAG_LW:
-                if (wordHead != NULL) {
-                    printLongestWord(outputFP, wordHead);
-                    firstSection = 0;
-                }
-                break;
+    // =========================================================================
+    // PHASE 2: Write every target's report from the structures built above
+    // =========================================================================
 
-            case FLAG_LL:
-                if (lineHead != NULL) {
-                    printLongestLine(outputFP, lineHead);
-                    firstSection = 0;
-                }
-                break;
+    REPORT_DATA report;
+    report.options = options;
+    report.fileData = fileData;
+    report.dataSize = dataSize;
+    report.charFrequency = charFrequency;
+    report.charFirstPos = charFirstPos;
+    report.uniqueCharCount = uniqueCharCount;
+    report.pairFrequency = pairFrequency;
+    report.codePoints = &codePoints;
+    report.scan = &scan;
+    report.diffWords = (options->diffFile != NULL) ? &diffWords : NULL;
+    report.diffLines = (options->diffFile != NULL) ? &diffLines : NULL;
+    report.diffWordsA = diffWordsA;
+    report.diffLinesA = diffLinesA;
+    report.linesPresorted = linesPresorted;
+    report.sortedLines = &sortedLines;
+    report.scanFilter = scanFilter;
+    report.bucketData = bucketData;
+    report.buckets = &buckets;
+    renderTargets(targets, targetCount, &report);
+    int written = closeOutputTargets(targets, targetCount);
+    if (stats != NULL) {
+        markPhase(stats, PHASE_RENDER);
+        if (options->stats) {
+            printRunStats(stderr, stats, &report);
+        }
+        if (options->perfCounters) {
+            printPerfCounters(stderr, stats);
         }
     }
 
     // Free allocated memory
-    if (wordHead != NULL) {
-        freeWordList(wordHead);
+    freeRegex(lineFilter.regex);
+    freeStopwords(&stopwords);
+    trackedFree(fileData, (size_t)bufferSize + 1, MEM_BUFFERS);
+    trackedFree(pairFrequency, sizeof(int) * PAIR_RANGE, MEM_TABLES);
+    trackedFree(codePoints.table, sizeof(CODE_POINT) * (size_t)codePoints.tableSize,
+                MEM_TABLES);
+    trackedFree(bucketData, (size_t)dataSize + 2, MEM_BUFFERS);
+    freeBucketSet(&buckets);
+    if (options->diffFile != NULL) {
+        freeWordList(diffWords.head);
+        freeWordList(diffLines.head);
+        trackedFree(diffWords.slots, sizeof(WORD *) * (size_t)diffWords.tableSize, MEM_TABLES);
+        trackedFree(diffLines.slots, sizeof(WORD *) * (size_t)diffLines.tableSize, MEM_TABLES);
+    }
+    if (scan.wordHead != NULL) {
+        freeWordList(scan.wordHead);
     }
-    if (lineHead != NULL) {
-        freeLineList(lineHead);
+    if (scan.lineHead != NULL) {
+        freeLineList(scan.lineHead);
+    }
+    if (options->allocStats) {
+        printAllocStats(stderr);
     }
 
-    // Close files
+    // Close the input (the outputs were closed above)
     fclose(inputFP);
-    if (outputFile != NULL) {
-        fclose(outputFP);
+    if (!written) {
+        if (options->compress != COMPRESS_NONE) {
+            printCompressorError();
+        } else {
+            printOutputWriteError();   // The disk filled up, say
+        }
+        return 0;  // Error
     }
 
     return 1;  // Success
@@ -1013,38 +6910,14 @@ void processBatchFile(char *batchFilename) {
         // Now we have argc and argv for this batch command
         // Parse and analyze
         if (batchArgc >= 3) {
-            char *inputFile = NULL;
-            char *outputFile = NULL;
-            int requestCharAnalysis = 0;
-            int requestWordAnalysis = 0;
-            int requestLineAnalysis = 0;
-            int requestLongestWord = 0;
-            int requestLongestLine = 0;
-            int flagOrder[MAX_FLAGS];
-            int flagCount = 0;
+            OPTIONS options;
 
             // Parse the arguments for this batch command
-            int parseResult = parseArguments(batchArgc, tokens,
-                                            &inputFile,
-                                            &outputFile,
-                                            &requestCharAnalysis,
-                                            &requestWordAnalysis,
-                                            &requestLineAnalysis,
-                                            &requestLongestWord,
-                                            &requestLongestLine,
-                                            flagOrder,
-                                            &flagCount);
+            int parseResult = parseArguments(batchArgc, tokens, &options);
 
             if (parseResult == 1) {
                 // Arguments are valid - analyze the file
-                analyzeFile(inputFile, outputFile,
-                           requestCharAnalysis,
-                           requestWordAnalysis,
-                           requestLineAnalysis,
-                           requestLongestWord,
-                           requestLongestLine,
-                           flagOrder,
-                           flagCount);
+                analyzeFile(&options);
             }
             // If parseResult == 0, error message was already printed by parseArguments
         }
@@ -0,0 +1,326 @@
+// =============================================================================
+// gencorpus - Synthetic corpus generator for the MADCounter benchmarks
+// =============================================================================
+// Writes a text file of (about) the requested size to stdout, shaped like
+// the inputs that stress different parts of madcounter:
+//
+//   words  Lines of words drawn from a Zipf-distributed vocabulary (natural
+//          language: a few very common words, a long tail of rare ones)
+//   lines  Whole lines drawn from a Zipf-distributed set of lines (many
+//          repeated lines: the -l table stays small, counts grow)
+//   ids    Log lines that each carry a unique request ID (almost every
+//          word and line is unique: the tables grow with the file)
+//   long   Very long lines of Zipf words (a few lines, megabytes each)
+//
+// The output depends only on the arguments, so the same command always
+// writes the same file and benchmark runs can be compared.
+//
+// Usage: gencorpus <kind> <size>[K|M|G] [-v vocab] [-w words] [-z exponent]
+//                  [-L line_bytes] [-s seed]
+// =============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+// =============================================================================
+// CONSTANTS AND DEFINITIONS
+// =============================================================================
+
+#define KIND_WORDS 0
+#define KIND_LINES 1
+#define KIND_IDS   2
+#define KIND_LONG  3
+
+#define MAX_WORD_LENGTH 32        // Longest vocabulary word (rank-derived, so short)
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// Syllables vocabulary words are spelled from: rank r is written in base
+// SYLLABLE_COUNT, so every rank gets a different word
+const char *syllables[] = {
+    "ba", "ke", "mi", "no", "ru", "sa", "te", "vi", "lo", "da",
+    "fe", "gi", "ho", "ju", "pa", "re", "si", "to", "wu", "ze"
+};
+#define SYLLABLE_COUNT 20
+
+// Log levels for the ids corpus, most common first
+const char *logLevels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+#define LOG_LEVEL_COUNT 6
+
+// =============================================================================
+// DATA STRUCTURES
+// =============================================================================
+
+// SETTINGS struct - everything parsed from the command line
+typedef struct settings {
+    int kind;                 // KIND_*
+    long long size;           // Bytes to write (the last line may run over)
+    int vocabulary;           // -v: distinct words (or lines, for kind lines)
+    int wordsPerLine;         // -w: average words per line
+    double exponent;          // -z: Zipf exponent (1.0 = classic Zipf)
+    long long lineBytes;      // -L: line length for kind long
+    uint64_t seed;            // -s: random seed
+} SETTINGS;
+
+// ZIPF struct - a Zipf distribution over ranks 0..count-1, sampled by
+// binary search in its cumulative distribution
+typedef struct zipf {
+    double *cumulative;
+    int count;
+} ZIPF;
+
+// =============================================================================
+// FUNCTION PROTOTYPES
+// =============================================================================
+
+uint64_t nextRandom(uint64_t *state);
+double nextUniform(uint64_t *state);
+void initZipf(ZIPF *zipf, int count, double exponent);
+int sampleZipf(ZIPF *zipf, uint64_t *state);
+int spellWord(int rank, char *word);
+long long parseSize(const char *text);
+int parseSettings(int argc, char *argv[], SETTINGS *settings);
+void printUsage();
+
+// =============================================================================
+// MAIN PROGRAM
+// =============================================================================
+
+int main(int argc, char *argv[]) {
+    SETTINGS settings;
+    if (!parseSettings(argc, argv, &settings)) {
+        printUsage();
+        return 1;
+    }
+
+    static char buffer[OUTPUT_BUFFER_SIZE];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+
+    uint64_t state = settings.seed;
+    ZIPF words;
+    initZipf(&words, settings.vocabulary, settings.exponent);
+
+    // kind lines: the line of rank r is a fixed run of words seeded by r
+    ZIPF lineWords;
+    memset(&lineWords, 0, sizeof(ZIPF));
+    if (settings.kind == KIND_LINES) {
+        initZipf(&lineWords, 4096, settings.exponent);
+    }
+
+    char word[MAX_WORD_LENGTH];
+    long long written = 0;
+    long long lineNumber = 0;
+    while (written < settings.size) {
+        long long lineLength = 0;
+
+        if (settings.kind == KIND_IDS) {
+            // 2024-01-01T00:00:00Z LEVEL req=<unique id> user=<word> <words>
+            long long seconds = lineNumber / 8;
+            lineLength += printf("2024-01-%02lldT%02lld:%02lld:%02lldZ %s req=%016llx user=",
+                                 1 + (seconds / 86400) % 28, (seconds / 3600) % 24,
+                                 (seconds / 60) % 60, seconds % 60,
+                                 logLevels[nextRandom(&state) % LOG_LEVEL_COUNT],
+                                 (unsigned long long)nextRandom(&state));
+            int length = spellWord(sampleZipf(&words, &state), word);
+            fwrite(word, 1, length, stdout);
+            lineLength += length;
+        }
+
+        if (settings.kind == KIND_LINES) {
+            // Replay line r from its own seed, so it comes out the same every time
+            uint64_t lineState = settings.seed ^ (0x9E3779B97F4A7C15ULL *
+                                                  (uint64_t)(sampleZipf(&words, &state) + 1));
+            int count = 1 + (int)(nextRandom(&lineState) % (2 * settings.wordsPerLine - 1));
+            for (int i = 0; i < count; i++) {
+                int length = spellWord(sampleZipf(&lineWords, &lineState), word);
+                if (i > 0) {
+                    putchar(' ');
+                    lineLength++;
+                }
+                fwrite(word, 1, length, stdout);
+                lineLength += length;
+            }
+        } else {
+            // words, ids and long: words until the line is long enough
+            long long target = settings.lineBytes;
+            int count = 0;
+            if (settings.kind != KIND_LONG) {
+                target = -1;
+                count = 1 + (int)(nextRandom(&state) % (2 * settings.wordsPerLine - 1));
+            }
+            for (int i = 0; target >= 0 ? lineLength < target : i < count; i++) {
+                int length = spellWord(sampleZipf(&words, &state), word);
+                if (lineLength > 0) {
+                    putchar(' ');
+                    lineLength++;
+                }
+                fwrite(word, 1, length, stdout);
+                lineLength += length;
+            }
+        }
+
+        putchar('\n');
+        written += lineLength + 1;
+        lineNumber++;
+    }
+
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "gencorpus: write failed\n");
+        return 1;
+    }
+    free(words.cumulative);
+    if (settings.kind == KIND_LINES) {
+        free(lineWords.cumulative);
+    }
+    return 0;
+}
+
+// =============================================================================
+// RANDOM NUMBERS
+// =============================================================================
+
+// nextRandom - xorshift64* step: fast, and the same sequence on every platform
+uint64_t nextRandom(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// nextUniform - Uniform double in [0, 1)
+double nextUniform(uint64_t *state) {
+    return (double)(nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// initZipf - Builds the cumulative distribution P(rank) ~ 1 / (rank+1)^exponent
+void initZipf(ZIPF *zipf, int count, double exponent) {
+    zipf->count = count;
+    zipf->cumulative = (double *)malloc(sizeof(double) * count);
+    if (zipf->cumulative == NULL) {
+        fprintf(stderr, "gencorpus: memory allocation failed\n");
+        exit(1);
+    }
+    double sum = 0.0;
+    for (int i = 0; i < count; i++) {
+        sum += 1.0 / pow((double)(i + 1), exponent);
+        zipf->cumulative[i] = sum;
+    }
+    for (int i = 0; i < count; i++) {
+        zipf->cumulative[i] /= sum;
+    }
+}
+
+// sampleZipf - Draws a rank: the first whose cumulative probability
+// reaches a uniform draw
+int sampleZipf(ZIPF *zipf, uint64_t *state) {
+    double u = nextUniform(state);
+    int low = 0;
+    int high = zipf->count - 1;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (zipf->cumulative[middle] < u) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// spellWord - Writes the word for a vocabulary rank (not NUL-terminated)
+// Returns: Its length
+int spellWord(int rank, char *word) {
+    int length = 0;
+    do {
+        memcpy(word + length, syllables[rank % SYLLABLE_COUNT], 2);
+        length += 2;
+        rank /= SYLLABLE_COUNT;
+    } while (rank > 0);
+    return length;
+}
+
+// =============================================================================
+// ARGUMENT PARSING
+// =============================================================================
+
+// parseSize - Parses a byte count with an optional K, M or G suffix
+// Returns: The count, or -1 if the text isn't one
+long long parseSize(const char *text) {
+    char *end = NULL;
+    long long value = strtoll(text, &end, 10);
+    if (end == text || value <= 0) {
+        return -1;
+    }
+    if (*end == 'K' || *end == 'k') {
+        value <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        value <<= 20;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        value <<= 30;
+        end++;
+    }
+    return (*end == '\0') ? value : -1;
+}
+
+// parseSettings - Fills in SETTINGS from argv
+// Returns: 1 if the arguments are valid, 0 if not
+int parseSettings(int argc, char *argv[], SETTINGS *settings) {
+    settings->kind = KIND_WORDS;
+    settings->vocabulary = 50000;
+    settings->wordsPerLine = 10;
+    settings->exponent = 1.0;
+    settings->lineBytes = 1 << 20;
+    settings->seed = 0x5EED;
+
+    if (argc < 3) {
+        return 0;
+    }
+    if (strcmp(argv[1], "words") == 0) {
+        settings->kind = KIND_WORDS;
+    } else if (strcmp(argv[1], "lines") == 0) {
+        settings->kind = KIND_LINES;
+    } else if (strcmp(argv[1], "ids") == 0) {
+        settings->kind = KIND_IDS;
+    } else if (strcmp(argv[1], "long") == 0) {
+        settings->kind = KIND_LONG;
+    } else {
+        return 0;
+    }
+    settings->size = parseSize(argv[2]);
+    if (settings->size < 0) {
+        return 0;
+    }
+
+    for (int i = 3; i + 1 < argc; i += 2) {
+        const char *value = argv[i + 1];
+        if (strcmp(argv[i], "-v") == 0) {
+            settings->vocabulary = atoi(value);
+        } else if (strcmp(argv[i], "-w") == 0) {
+            settings->wordsPerLine = atoi(value);
+        } else if (strcmp(argv[i], "-z") == 0) {
+            settings->exponent = atof(value);
+        } else if (strcmp(argv[i], "-L") == 0) {
+            settings->lineBytes = parseSize(value);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            settings->seed = strtoull(value, NULL, 10) | 1;   // xorshift needs a nonzero state
+        } else {
+            return 0;
+        }
+    }
+    if ((argc - 3) % 2 != 0) {
+        return 0;
+    }
+    return settings->vocabulary > 0 && settings->wordsPerLine > 0 &&
+           settings->exponent > 0.0 && settings->lineBytes > 0;
+}
+
+void printUsage() {
+    fprintf(stderr, "USAGE: gencorpus words|lines|ids|long <size>[K|M|G] "
+                    "[-v vocab] [-w words] [-z exponent] [-L line_bytes] [-s seed]\n");
+}
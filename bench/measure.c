@@ -0,0 +1,81 @@
+// =============================================================================
+// measure - Runs one command and reports what it cost
+// =============================================================================
+// The benchmark runner's stopwatch: runs the command with its stdout sent
+// to /dev/null (its stderr is left alone), then prints one line to stdout:
+//
+//   wall=<s> user=<s> sys=<s> maxrss_kb=<peak resident set> status=<exit>
+//
+// The times and the peak RSS come from wait4(), so no /usr/bin/time (which
+// isn't installed everywhere, and prints differently on Linux and macOS) is
+// needed.
+//
+// Usage: measure <command> [args...]
+// =============================================================================
+
+// wait4() and struct rusage need the BSD/POSIX extensions -std=c99 hides
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+double secondsOf(struct timeval tv);
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "USAGE: measure <command> [args...]\n");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("measure: fork");
+        return 1;
+    }
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0) {
+            dup2(devNull, STDOUT_FILENO);
+            close(devNull);
+        }
+        execvp(argv[1], argv + 1);
+        perror("measure: exec");
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("measure: wait4");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // ru_maxrss is in kilobytes on Linux but in bytes on macOS
+    long maxRss = usage.ru_maxrss;
+#ifdef __APPLE__
+    maxRss /= 1024;
+#endif
+
+    printf("wall=%.6f user=%.6f sys=%.6f maxrss_kb=%ld status=%d\n",
+           (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+           secondsOf(usage.ru_utime), secondsOf(usage.ru_stime), maxRss,
+           WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    return 0;
+}
+
+// secondsOf - A struct timeval as seconds
+double secondsOf(struct timeval tv) {
+    return (double)tv.tv_sec + tv.tv_usec / 1e6;
+}
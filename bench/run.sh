@@ -0,0 +1,112 @@
+#!/bin/sh
+# =============================================================================
+# MADCounter Benchmark Runner (`make bench`)
+# =============================================================================
+#
+# WHAT THIS SCRIPT DOES:
+#   1. Generates synthetic corpora with bench/gencorpus (once per kind/size;
+#      they are kept in $BENCH_DIR and reused by later runs)
+#   2. Runs madcounter --stats over each corpus with each flag combination,
+#      plus one batch-mode run, under bench/measure
+#   3. Prints one JSON object per run (JSON Lines) to stdout and saves the
+#      same lines to $BENCH_DIR/results.jsonl
+#
+# Each result line looks like:
+#   {"corpus":"words","bytes":8388608,"flags":"-w","wall_s":0.41,
+#    "user_s":0.38,"sys_s":0.02,"mb_per_s":19.5,"peak_rss_kb":52340,"status":0,
+#    "phase_wall_s":{"read":0.01,"chars":0,"scan":0.22,"sort":0.09,"render":0.08},
+#    "phase_cpu_s":{...the same phases...}}
+#
+# The phase times are madcounter's own --stats report (summed over the
+# commands of the batch-mode run).
+#
+# SETTINGS (environment variables, or make variables: make bench BENCH_SIZES=1M):
+#   BENCH_SIZES    Corpus sizes, with K/M/G suffixes   (default: "1M 8M 32M")
+#   BENCH_CORPORA  Corpus kinds (see bench/gencorpus.c) (default: "words lines ids long")
+#   BENCH_DIR      Where corpora and results go         (default: /tmp/madcounter-bench)
+#   BENCH_BIN      The madcounter binary to measure     (default: ./madcounter)
+#
+# =============================================================================
+
+set -e  # Exit on any error
+
+BENCH_SIZES="${BENCH_SIZES:-1M 8M 32M}"
+BENCH_CORPORA="${BENCH_CORPORA:-words lines ids long}"
+BENCH_DIR="${BENCH_DIR:-/tmp/madcounter-bench}"
+BENCH_BIN="${BENCH_BIN:-./madcounter}"
+
+# The flag combinations each corpus is run with, one per line
+FLAG_SETS="-c
+-c2
+-w
+-l
+-Lw -Ll
+-w --sort freq
+-c -w -l -Lw -Ll
+-w -l --format json"
+
+mkdir -p "$BENCH_DIR"
+RESULTS="$BENCH_DIR/results.jsonl"
+STATS="$BENCH_DIR/stats.txt"
+: > "$RESULTS"
+
+# report CORPUS BYTES FLAGS MEASURE_LINE
+# Turns one line of bench/measure output, plus the --stats report left in
+# $STATS, into a JSON result line
+report() {
+    awk -v corpus="$1" -v bytes="$2" -v flags="$3" -v measured="$4" '
+    # "Phase: scan, Wall: 0.049914 s, CPU: 0.049226 s"
+    $1 == "Phase:" && $2 != "total," {
+        name = substr($2, 1, length($2) - 1)
+        if (!(name in wall)) {
+            names[++count] = name
+        }
+        wall[name] += $4
+        cpu[name] += $7
+    }
+    END {
+        fields = split(measured, pairs, " ")
+        for (i = 1; i <= fields; i++) {
+            split(pairs[i], kv, "=")
+            value[kv[1]] = kv[2]
+        }
+        mbps = (value["wall"] > 0) ? bytes / 1048576 / value["wall"] : 0
+        printf("{\"corpus\":\"%s\",\"bytes\":%d,\"flags\":\"%s\",\"wall_s\":%s," \
+               "\"user_s\":%s,\"sys_s\":%s,\"mb_per_s\":%.2f,\"peak_rss_kb\":%s," \
+               "\"status\":%s",
+               corpus, bytes, flags, value["wall"], value["user"], value["sys"],
+               mbps, value["maxrss_kb"], value["status"])
+        printf(",\"phase_wall_s\":{")
+        for (i = 1; i <= count; i++) {
+            printf("%s\"%s\":%.6f", (i > 1) ? "," : "", names[i], wall[names[i]])
+        }
+        printf("},\"phase_cpu_s\":{")
+        for (i = 1; i <= count; i++) {
+            printf("%s\"%s\":%.6f", (i > 1) ? "," : "", names[i], cpu[names[i]])
+        }
+        printf("}}\n")
+    }' "$STATS" | tee -a "$RESULTS"
+}
+
+for size in $BENCH_SIZES; do
+    for corpus in $BENCH_CORPORA; do
+        file="$BENCH_DIR/$corpus-$size.txt"
+        if [ ! -f "$file" ]; then
+            bench/gencorpus "$corpus" "$size" > "$file"
+        fi
+        bytes=$(wc -c < "$file" | tr -d ' ')
+
+        echo "$FLAG_SETS" | while read -r flags; do
+            # $flags is split into separate arguments on purpose
+            line=$(bench/measure "$BENCH_BIN" -f "$file" $flags --stats 2> "$STATS")
+            report "$corpus" "$bytes" "$flags" "$line"
+        done
+
+        # Batch mode: every flag combination as one batch file
+        batch="$BENCH_DIR/batch-$corpus-$size.txt"
+        echo "$FLAG_SETS" | sed "s|^|-f $file |; s|$| --stats|" > "$batch"
+        line=$(bench/measure "$BENCH_BIN" -B "$batch" 2> "$STATS")
+        count=$(wc -l < "$batch" | tr -d ' ')
+        report "$corpus" "$((bytes * count))" "-B (all of the above)" "$line"
+    done
+done
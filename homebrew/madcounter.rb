@@ -78,7 +78,7 @@ class Madcounter < Formula
     # Compile from source using the system C compiler
     # Homebrew sets CC, CFLAGS, etc. automatically based on the platform
     system ENV.cc,
-           "-Wall", "-Werror", "-O2", "-std=c99",
+           "-Wall", "-Werror", "-O2", "-std=c99", "-pthread",
            "-o", "madcounter",
            "MADCounter.c"
 
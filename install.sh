@@ -154,7 +154,8 @@ compile() {
     # -Werror  = warnings are errors
     # -O2      = optimize for speed
     # -std=c99 = C99 standard
-    gcc -Wall -Werror -O2 -std=c99 -o "$BINARY_NAME" MADCounter.c
+    # -pthread = POSIX threads (-o fan-out)
+    gcc -Wall -Werror -O2 -std=c99 -pthread -o "$BINARY_NAME" MADCounter.c
 
     success "Compiled successfully: ./$BINARY_NAME"
     echo ""